@@ -151,7 +151,11 @@
 	#endif
 
 	/*
-	 * Activates the UART receive buffer 
+	 * Activates the UART receive buffer, filled by the mixer
+	 * on each scanline. Bytes arriving while it is full are
+	 * dropped and counted, see GetUartStats().
+	 * With the inline mixer, the UART is serviced in the time
+	 * slot of the PCM channel: requires SOUND_CHANNEL_5_ENABLE=0.
 	 * Not supported with video mode 2.
 	 *
 	 * 0 = no
@@ -162,11 +166,8 @@
 	#endif
 
 	/*
-	 * Activates the UART receive buffer 
-	 * Not supported with video mode 2.
-	 *
-	 * 0 = no
-	 * 1 = yes
+	 * Size of the UART receive buffer, must be a power of 2.
+	 * The buffer holds one byte less than its size.
 	 */
 	#ifndef UART_RX_BUFFER_SIZE
 		#define UART_RX_BUFFER_SIZE 128
@@ -178,6 +179,94 @@
 		#endif
 	#endif
 
+	/*
+	 * Activates the UART transmit buffer, see UartSendChar().
+	 * The mixer moves one byte to the UART on each scanline the
+	 * UART is ready, so sending never waits on the line. 
+	 * Only supported with the inline mixer and
+	 * SOUND_CHANNEL_5_ENABLE=0.
+	 *
+	 * 0 = no
+	 * 1 = yes
+	 */
+	#ifndef UART_TX_BUFFER
+		#define UART_TX_BUFFER 0
+	#endif
+
+	/*
+	 * Size of the UART transmit buffer, must be a power of 2.
+	 * The buffer holds one byte less than its size.
+	 */
+	#ifndef UART_TX_BUFFER_SIZE
+		#define UART_TX_BUFFER_SIZE 64
+	#else
+		#if UART_TX_BUFFER_SIZE !=2 &&   UART_TX_BUFFER_SIZE !=4 &&  UART_TX_BUFFER_SIZE !=8 && \
+			UART_TX_BUFFER_SIZE !=16 &&  UART_TX_BUFFER_SIZE !=32 && UART_TX_BUFFER_SIZE !=64 && \
+			UART_TX_BUFFER_SIZE !=128 && UART_TX_BUFFER_SIZE !=256
+			#error Invalid size for UART_TX_BUFFER_SIZE: must be a power of 2.
+		#endif
+	#endif
+
+	/*
+	 * UART speed used with UART_RX_BUFFER or UART_TX_BUFFER,
+	 * MIDI_IN always uses 31250 bauds.
+	 * At one byte per scanline, the buffers keep up with
+	 * up to 115200 bauds.
+	 */
+	#ifndef UART_BAUD_RATE
+		#define UART_BAUD_RATE 57600
+	#endif
+
+	//Framing of UartSendPacket() and UartReadPacket():
+	//sync, length, payload, CRC-CCITT of length and payload (lsb first)
+	#define UART_PACKET_SYNC 0x7e
+	#define UART_PACKET_OVERHEAD 4
+
+	/*
+	 * Queues EEPROM block writes and performs them one byte
+	 * per VSYNC instead of blocking the caller. Bytes that
+	 * already hold the right value are skipped.
+	 *
+	 * 0 = no
+	 * 1 = yes
+	 */
+	#ifndef EEPROM_WRITE_QUEUE
+		#define EEPROM_WRITE_QUEUE 0
+	#endif
+
+	/*
+	 * Number of blocks the EEPROM write queue can hold.
+	 * Each entry takes EEPROM_BLOCK_SIZE+3 bytes of RAM.
+	 */
+	#ifndef EEPROM_WRITE_QUEUE_SIZE
+		#define EEPROM_WRITE_QUEUE_SIZE 1
+	#endif
+
+	/*
+	 * Keeps a RAM directory of the EEPROM blocks, built once
+	 * at startup, so block reads and writes don't rescan
+	 * every block header. Takes 3*EEPROM_DIR_SIZE+8 bytes of RAM.
+	 *
+	 * 0 = no
+	 * 1 = yes
+	 */
+	#ifndef EEPROM_DIRECTORY
+		#define EEPROM_DIRECTORY 0
+	#endif
+
+	/*
+	 * Fills the free RAM between the variables and the stack
+	 * with STACK_PAINT at startup, so StackFree() can tell how
+	 * deep the stack has been since (interrupts included).
+	 *
+	 * 0 = no
+	 * 1 = yes
+	 */
+	#ifndef STACK_MONITOR
+		#define STACK_MONITOR 0
+	#endif
+	#define STACK_PAINT 0xc5
+
 	/*
 	 * Screen center adjustment for mode 1 only.
 	 * Useful if your game field absolutely needs a non-even width.
@@ -252,6 +341,71 @@
 	#ifndef ENABLE_MIXER
 		#define ENABLE_MIXER 1
 	#endif
+
+	/*
+	 * Measures the CPU cycles spent in ProcessMusic() each frame.
+	 * Read the results with GetMusicCycles().
+	 *
+	 * 0 = no
+	 * 1 = yes
+	 */
+	#ifndef SOUND_ENGINE_PROFILE
+		#define SOUND_ENGINE_PROFILE 0
+	#endif
+
+	/*
+	 * Song data format expected by StartSong()
+	 *
+	 * 0 = MIDI stream from midiconv (default)
+	 * 1 = fixed-width event stream from tools/songc.c, the player
+	 *     reads at most SONG_EVENTS_PER_FRAME events each frame
+	 *     and does not support SetSongSpeed()
+	 */
+	#ifndef SONG_COMPILED
+		#define SONG_COMPILED 0
+	#endif
+
+	/*
+	 * Max number of compiled song events played in one frame. Events
+	 * past this are delayed to the next frame. songc reports the songs
+	 * that go over it.
+	 */
+	#ifndef SONG_EVENTS_PER_FRAME
+		#define SONG_EVENTS_PER_FRAME 8
+	#endif
+
+	/*
+	 * Streams a compiled song from the SD card with StartSongStream()
+	 * instead of reading it from flash. The card is read during VSYNC,
+	 * at most SONG_STREAM_BUDGET bytes per frame, into two banks of
+	 * SONG_STREAM_BANK_SIZE bytes. Requires SONG_COMPILED=1 and links
+	 * mmc.s and mmc_lib.c.
+	 *
+	 * 0 = no
+	 * 1 = yes
+	 */
+	#ifndef SONG_STREAMING
+		#define SONG_STREAMING 0
+	#elif SONG_STREAMING == 1 && SONG_COMPILED == 0
+		#error SONG_STREAMING requires SONG_COMPILED=1
+	#endif
+
+	/*
+	 * Size of each of the two song stream banks, must be at least
+	 * SONG_EVENT_SIZE*SONG_EVENTS_PER_FRAME to keep up with the busiest
+	 * frames.
+	 */
+	#ifndef SONG_STREAM_BANK_SIZE
+		#define SONG_STREAM_BANK_SIZE 32
+	#endif
+
+	/*
+	 * Max number of SPI bytes clocked in per frame by the song
+	 * stream, including the data token polls between sectors.
+	 */
+	#ifndef SONG_STREAM_BUDGET
+		#define SONG_STREAM_BUDGET 24
+	#endif
 		
 	/*
 	 * Define the ammount of memory to allocate
@@ -289,6 +443,38 @@
 		#define CONTROLLERS_VSYNC_READ 1
 	#endif
 
+	/*
+	 * Turns the joypad states into press, release and repeat events
+	 * each time the controllers are read. Events are buffered so none
+	 * are lost while the program is busy, fetch them with GetInputEvent().
+	 *
+	 * 0 = no
+	 * 1 = yes
+	 */
+	#ifndef INPUT_EVENTS
+		#define INPUT_EVENTS 0
+	#endif
+
+	/*
+	 * Number of buffered input events, must be a power of two.
+	 * Each event takes 6 bytes of RAM.
+	 */
+	#ifndef INPUT_EVENTS_QUEUE_SIZE
+		#define INPUT_EVENTS_QUEUE_SIZE 16
+	#endif
+
+	/*
+	 * Default auto-repeat of held buttons, in frames. The delay is
+	 * the time before the first repeat, the rate the time between
+	 * the following ones. Can be changed with SetInputRepeat().
+	 */
+	#ifndef INPUT_REPEAT_DELAY
+		#define INPUT_REPEAT_DELAY 20
+	#endif
+	#ifndef INPUT_REPEAT_RATE
+		#define INPUT_REPEAT_RATE 6
+	#endif
+
 	/*
 	 * Determines the type of audio mixer to use. Currently two mixer are available:
 	 * 
@@ -380,6 +566,21 @@
 	#define PC_SLIDE_SPEED	12
 	#define PATCH_END		0xff
 
+	//Compiled song events (SONG_COMPILED=1), high nibble of
+	//the event type byte, the low nibble is the channel.
+	//Each event is {type,param1,param2,delta to next event}
+	#define SONG_EV_NOTE			0x00	//param1=note, param2=volume (0=note off)
+	#define SONG_EV_VOLUME			0x10	//param1=track volume
+	#define SONG_EV_EXPRESSION		0x20	//param1=expression volume
+	#define SONG_EV_TREMOLO_LEVEL	0x30	//param1=level
+	#define SONG_EV_TREMOLO_RATE	0x40	//param1=rate
+	#define SONG_EV_PATCH			0x50	//param1=patch number
+	#define SONG_EV_LOOP_START		0x60
+	#define SONG_EV_LOOP_END		0x70
+	#define SONG_EV_WAIT			0x80	//no-op, spans long delays
+	#define SONG_EV_END				0xf0
+	#define SONG_EVENT_SIZE			4
+
 
 	#if SOUND_MIXER == MIXER_TYPE_INLINE
 		#define WAVE_CHANNELS 3
@@ -388,6 +589,9 @@
 		#define CHANNEL_STRUCT_SIZE 6
 
 		#if SOUND_CHANNEL_5_ENABLE==1
+			#if UART_RX_BUFFER == 1 || UART_TX_BUFFER == 1
+				#error UART buffers with the inline mixer require SOUND_CHANNEL_5_ENABLE=0
+			#endif
 			#define PCM_CHANNELS 1
 			#define CHANNELS WAVE_CHANNELS+NOISE_CHANNELS+PCM_CHANNELS
 			#define AUDIO_OUT_HSYNC_CYCLES 212
@@ -395,8 +599,14 @@
 		#else
 			#define PCM_CHANNELS 0
 			#define CHANNELS WAVE_CHANNELS+NOISE_CHANNELS
-			#define AUDIO_OUT_HSYNC_CYCLES 212-43
-			#define AUDIO_OUT_VSYNC_CYCLES 212-43
+			#if UART_RX_BUFFER == 1 || UART_TX_BUFFER == 1
+				//UART serviced in place of channel 5, see update_sound
+				#define UART_MIXER_CYCLES (2+(UART_RX_BUFFER*29)+(UART_TX_BUFFER*22))
+			#else
+				#define UART_MIXER_CYCLES 0
+			#endif
+			#define AUDIO_OUT_HSYNC_CYCLES 212-43+UART_MIXER_CYCLES
+			#define AUDIO_OUT_VSYNC_CYCLES 212-43+UART_MIXER_CYCLES
 		#endif
 	#else
 
@@ -416,6 +626,10 @@
 		#define AUDIO_OUT_HSYNC_CYCLES 135
 		#define AUDIO_OUT_VSYNC_CYCLES 68
 
+		#if UART_TX_BUFFER == 1
+			#error UART_TX_BUFFER requires the inline mixer (SOUND_MIXER=1)
+		#endif
+
 	#endif
 
 
@@ -454,6 +668,8 @@
 	#define JOYPAD_DATA2_PIN PA1
 
 	#define EEPROM_BLOCK_SIZE 32
+	#define EEPROM_BLOCKS_COUNT 64 //2K of EEPROM on the ATmega644
+	#define EEPROM_DIR_SIZE 64 //power of 2, >= EEPROM_BLOCKS_COUNT
 	#define EEPROM_HEADER_SIZE 1
 	#define EEPROM_SIGNATURE 0x555A
 	#define EEPROM_SIGNATURE2 0x555B
@@ -462,6 +678,7 @@
 	#define EEPROM_ERROR_FULL 0x2
 	#define EEPROM_ERROR_BLOCK_NOT_FOUND 0x3
 	#define EEPROM_ERROR_NOT_FORMATTED 0x4
+	#define EEPROM_ERROR_QUEUE_FULL 0x5
 
 	#if VIDEO_MODE == 1 
 		#include "videoMode1/videoMode1.def.h"
@@ -51,6 +51,9 @@
 		unsigned int  barrel;				//16bit LFSR barrel shifter
 		unsigned char divider;				//divider accumulator
 		unsigned char reserved;
+		#ifndef __AVR__
+			const char *hostAlignment;		//same size as the other channels in host builds (tools/sndrender.c)
+		#endif
 	};
 
 	//Common type for both channels (except noise chan)
@@ -58,7 +61,12 @@
 	{
 		unsigned char volume;				//(0-255)
 		unsigned int  step;					//8:8 fixed point
-		unsigned const char structAlignment[3];	//dont access!
+		#ifdef __AVR__
+			unsigned const char structAlignment[3];	//dont access!
+		#else
+			unsigned const char structAlignment;	//dont access! pointer sized in host builds
+			const char * const structAlignment2;
+		#endif
 	};
 
 
@@ -126,6 +134,7 @@
 		
 		unsigned char patchNo;
 		unsigned char fxPatchNo;
+		unsigned char fxPriority;		//priority of the playing fx, see TriggerFxPriority()
 		unsigned char patchLastStatus;
 		unsigned char patchNextDeltaTime;
 		unsigned char patchCurrDeltaTime;
@@ -150,6 +159,9 @@
 	extern unsigned char uart_rx_buf_start;
 	extern unsigned char uart_rx_buf_end;
 	extern unsigned char uart_rx_buf[];
+	extern unsigned char uart_tx_buf_start;
+	extern unsigned char uart_tx_buf_end;
+	extern unsigned char uart_tx_buf[];
 
 	struct  PatchStruct{   
    		unsigned char type;
@@ -232,11 +244,76 @@
 
 	struct EepromBlockStruct{
 		//some unique block ID assigned by ?. If 0xffff, block is free.
-		unsigned int id;
+		#ifdef __AVR__
+			unsigned int id;
+		#else
+			u16 id;		//16 bits like on the AVR, blocks stay 32 bytes in host builds (tools/host/core.c)
+		#endif
 		
 		//application specific data
 		//cast to your own types
 		unsigned char data[30];		
 	};
 
+	//Buffered joypad event, see GetInputEvent()
+	struct InputEvent{
+		u8 type;		//INPUT_PRESS, INPUT_RELEASE or INPUT_REPEAT
+		u8 joypad;
+		u16 button;		//one of the BTN_* values
+		u16 frame;		//frame counter when the event occured
+	};
+
+	//Journaled save, rotated over several blocks to spread the wear.
+	//Each record goes in the data part of a block.
+	#define EEPROM_JOURNAL_DATA_SIZE 26
+	struct EepromJournalRecord{
+		//incremented on each save, the newest valid record wins
+		u16 seq;
+
+		//CRC-CCITT of seq and data
+		u16 crc;
+
+		unsigned char data[EEPROM_JOURNAL_DATA_SIZE];
+	};
+
+	struct EepromJournal{
+		//the journal uses block ids baseId to baseId+slots-1
+		unsigned int baseId;
+		unsigned char slots;
+
+		//slot and sequence number of the next save
+		unsigned char next;
+		u16 seq;
+	};
+
+	//Random number stream, see RngSeed(). Streams seeded the same
+	//give the same numbers on any build.
+	struct Rng{
+		u32 state;
+	};
+
+	//UART error counters, see GetUartStats()
+	struct UartStats{
+		u8 rxOverflows;	//bytes received while the RX buffer was full, lost
+		u8 txOverflows;	//bytes or packets that did not fit the TX buffer
+		u8 badPackets;	//skipped bytes that were not a valid packet
+	};
+
+	//Song streaming counters, see GetSongStreamStats()
+	struct SongStreamStats{
+		u16 underruns;	//frames an event was due but not buffered yet
+		u16 stalls;		//frames the card was not ready with the next sector
+		u8 errors;		//bad data tokens, the stream stops on each
+	};
+
+	#if SONG_STREAMING == 1
+		//used by the sound engine to read the streamed song
+		extern bool SongStreamOpen(u32 firstSector);
+		extern void SongStreamClose(void);
+		extern bool SongStreamAvailable(u8 count);
+		extern u8 SongStreamRead(void);
+		extern u32 SongStreamTell(void);
+		extern void SongStreamSeek(u32 offset);
+	#endif
+
 #endif
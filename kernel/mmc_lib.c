@@ -20,6 +20,7 @@
 
 /*
  * Library to polay wav files in the background.
+ * With SONG_STREAMING=1, also streams compiled songs for the sound engine.
  */
 
 #include <stdbool.h>
@@ -44,7 +45,28 @@ long sectorsPerCluster;
 long maxRootDirectoryEntries;
 long bytesPerSector;
 
-mmc_SectorData sector;
+//lent by the caller of mmc_masterInit(), only used to look up files
+mmc_SectorData *sector;
+
+#if SONG_STREAMING == 1
+	#define SONG_STREAM_STOPPED	0
+	#define SONG_STREAM_TOKEN	1	//waiting for the next sector data token
+	#define SONG_STREAM_DATA	2	//reading sector data
+
+	u8  song_stream_bank[2][SONG_STREAM_BANK_SIZE];
+	u8  song_stream_fill[2];		//bytes buffered in each bank
+	u8  song_stream_play;			//bank the player reads from
+	u8  song_stream_read;			//read position in the played bank
+	u8  song_stream_state=SONG_STREAM_STOPPED;
+	bool song_stream_seeking;		//nothing was read since the last seek
+	u16 song_stream_skip;			//bytes to drop to reach the seek offset
+	u16 song_stream_sector_pos;		//bytes read in the current sector
+	u32 song_stream_first;			//first sector of the song
+	u32 song_stream_offset;			//song offset of the next byte the player reads
+	volatile bool song_stream_paused;	//the card is lent out, see PauseSongStream()
+	bool song_stream_resume;		//the stream was open when paused
+	struct SongStreamStats song_stream_stats;
+#endif
 
 void LoadRootDirectory(unsigned char *buffer){
 
@@ -55,14 +77,14 @@ void LoadRootDirectory(unsigned char *buffer){
 
 	//long bootRecordSector=sector_buffer_ptr->mbr.partition1.startSector;
 
-	long bootRecordSector=sector.mbr.partition1.startSector;
+	long bootRecordSector=sector->mbr.partition1.startSector;
 	mmc_readsector(bootRecordSector);
 
-	int reservedSectors=sector.bootRecord.reservedSectors;
-	int sectorsPerFat=sector.bootRecord.sectorsPerFat;
-	maxRootDirectoryEntries=sector.bootRecord.maxRootDirectoryEntries;
-	bytesPerSector=sector.bootRecord.bytesPerSector;
-	sectorsPerCluster=sector.bootRecord.sectorsPerCluster;
+	int reservedSectors=sector->bootRecord.reservedSectors;
+	int sectorsPerFat=sector->bootRecord.sectorsPerFat;
+	maxRootDirectoryEntries=sector->bootRecord.maxRootDirectoryEntries;
+	bytesPerSector=sector->bootRecord.bytesPerSector;
+	sectorsPerCluster=sector->bootRecord.sectorsPerCluster;
 
 	//get directory table
 	dirTableSector=bootRecordSector + reservedSectors + (sectorsPerFat * 2); //+ ((maxRootDirectoryEntries * 32) / bytesPerSector);
@@ -78,20 +100,20 @@ long GetFileSector(DirectoryTableEntry *file){
 u8 mmc_listDir(mmc_File* files, u8 count, const char* extFilter){
 	u8 c,i,j,k,pos,fileCount=0;
 
-	LoadRootDirectory(sector.buffer);
+	LoadRootDirectory(sector->buffer);
 	
 	//find files in the sector
-	for(i=0;i<count;i++){
+	for(i=0;i<16;i++){
 		//get only files
-		if((sector.files[i].fileAttributes & (FAT_ATTR_HIDDEN|FAT_ATTR_SYSTEM|FAT_ATTR_VOLUME|FAT_ATTR_DIRECTORY|FAT_ATTR_DEVICE))==0){
-			if((sector.files[i].filename[0]!=0) && (sector.files[i].filename[0]!=0xe5) && (sector.files[i].filename[0]!=0x05) && (sector.files[i].filename[0]!=0x2e)){									
+		if((sector->files[i].fileAttributes & (FAT_ATTR_HIDDEN|FAT_ATTR_SYSTEM|FAT_ATTR_VOLUME|FAT_ATTR_DIRECTORY|FAT_ATTR_DEVICE))==0){
+			if((sector->files[i].filename[0]!=0) && (sector->files[i].filename[0]!=0xe5) && (sector->files[i].filename[0]!=0x05) && (sector->files[i].filename[0]!=0x2e)){									
 				
 				//apply extension filter
-				if(extFilter==NULL || (sector.files[i].extension[0]==extFilter[0] && sector.files[i].extension[1]==extFilter[1] && sector.files[i].extension[2]==extFilter[2]) ){
+				if(extFilter==NULL || (sector->files[i].extension[0]==extFilter[0] && sector->files[i].extension[1]==extFilter[1] && sector->files[i].extension[2]==extFilter[2]) ){
 
 					pos=0;
 					for(j=0;j<8;j++){
-						c=sector.files[i].filename[j];
+						c=sector->files[i].filename[j];
 						if(c==0x20)break;
 						if(c=='~')c='_';
 						files[fileCount].filename[pos++]=c;
@@ -100,14 +122,14 @@ u8 mmc_listDir(mmc_File* files, u8 count, const char* extFilter){
 
 					//files[fileCount].filename[pos++]='.';
 					for(k=0;k<3;k++){
-						c=sector.files[i].extension[k];
+						c=sector->files[i].extension[k];
 						//if(c==0x20)break;
 						files[fileCount].extension[k]=c;
 					}
 					
 
-					files[fileCount].fileSize=sector.files[i].fileSize;				
-					files[fileCount].firstSector=GetFileSector(&sector.files[i]);	
+					files[fileCount].fileSize=sector->files[i].fileSize;				
+					files[fileCount].firstSector=GetFileSector(&sector->files[i]);	
 				
 //					PrintRam(x,y+fileCount,files[fileCount].filename);
 					//PrintLong(x+21,y+fileCount,files[fileCount].fileSize);
@@ -127,6 +149,13 @@ u8 mmc_listDir(mmc_File* files, u8 count, const char* extFilter){
 }
 
 
+u8 mmc_masterInit(u8 *buffer){
+	sector=(mmc_SectorData*)buffer;
+	return mmc_init(buffer);
+}
+
+#if SOUND_MIXER == MIXER_TYPE_VSYNC
+
 //starts playing wav file pointed at by lba
 void mmc_playerStart(mmc_File file){
 
@@ -182,10 +211,6 @@ void mmc_playerResume(){
 	}
 }
 
-u8 mmc_masterInit(){
-	return mmc_init(sector.buffer);
-}
-
 //call once on each vsync
 void mmc_playerProcess()
 {
@@ -276,3 +301,153 @@ void mmc_playerProcess()
 	
 	
 }
+
+#endif //SOUND_MIXER == MIXER_TYPE_VSYNC
+
+
+#if SONG_STREAMING == 1
+
+//stops the transfer in progress and releases the card
+static void SongStreamStop(){
+	if(song_stream_state!=SONG_STREAM_STOPPED){
+		mmc_send_command(12,0,0); //stop transfers
+		mmc_clock_and_release();
+		song_stream_state=SONG_STREAM_STOPPED;
+	}
+}
+
+//starts a multiple block read at the sector holding the offset and
+//throws away what was buffered, the player waits for the new data
+void SongStreamSeek(u32 offset){
+	u32 lba=song_stream_first+(offset>>9);
+
+	SongStreamStop();
+	mmc_send_command(18,(lba>>7) & 0xffff, (lba<<9) & 0xffff);
+	song_stream_skip=offset&511;
+	song_stream_offset=offset;
+	song_stream_fill[0]=0;
+	song_stream_fill[1]=0;
+	song_stream_play=0;
+	song_stream_read=0;
+	song_stream_seeking=true;
+	song_stream_state=SONG_STREAM_TOKEN;
+}
+
+//firstSector: start of the song, the file must not be fragmented
+bool SongStreamOpen(u32 firstSector){
+	song_stream_first=firstSector;
+	SongStreamSeek(0);
+	return true;
+}
+
+void SongStreamClose(){
+	SongStreamStop();
+}
+
+//returns true if count bytes can be read, counts an underrun otherwise
+bool SongStreamAvailable(u8 count){
+	//the song holds while paused, so it never seeks or closes meanwhile
+	if(song_stream_paused) return false;
+
+	if((u8)(song_stream_fill[song_stream_play]-song_stream_read+song_stream_fill[song_stream_play^1])>=count)
+		return true;
+
+	//waiting after a seek is expected
+	if(!song_stream_seeking) song_stream_stats.underruns++;
+	return false;
+}
+
+//call only after SongStreamAvailable()
+u8 SongStreamRead(){
+	u8 c=song_stream_bank[song_stream_play][song_stream_read++];
+
+	//bank finished, it can be loaded again while the other one plays
+	if(song_stream_read==SONG_STREAM_BANK_SIZE){
+		song_stream_fill[song_stream_play]=0;
+		song_stream_play^=1;
+		song_stream_read=0;
+	}
+
+	song_stream_offset++;
+	song_stream_seeking=false;
+	return c;
+}
+
+u32 SongStreamTell(){
+	return song_stream_offset;
+}
+
+/*
+ * Called during VSYNC, after the music is processed. Fills the banks
+ * from the card, at most SONG_STREAM_BUDGET bytes per frame so a slow
+ * card never takes more than a fixed slice of the frame.
+ */
+void ProcessSongStream(){
+	u8 budget=SONG_STREAM_BUDGET,bank,c;
+
+	if(song_stream_paused) return;
+
+	while(song_stream_state!=SONG_STREAM_STOPPED){
+
+		//the played bank is filled first, then the next one
+		bank=song_stream_play;
+		if(song_stream_fill[bank]==SONG_STREAM_BANK_SIZE) bank^=1;
+		if(song_stream_fill[bank]==SONG_STREAM_BANK_SIZE) return;	//both full
+
+		if(budget==0){
+			if(song_stream_state==SONG_STREAM_TOKEN) song_stream_stats.stalls++;
+			return;
+		}
+		budget--;
+
+		c=spi_byte(0xff);
+
+		if(song_stream_state==SONG_STREAM_TOKEN){
+			if(c==0xfe){
+				song_stream_state=SONG_STREAM_DATA;
+				song_stream_sector_pos=0;
+			}else if(c!=0xff){
+				//error token
+				song_stream_stats.errors++;
+				SongStreamStop();
+			}
+			continue;
+		}
+
+		if(song_stream_skip!=0){
+			song_stream_skip--;
+		}else{
+			song_stream_bank[bank][song_stream_fill[bank]++]=c;
+		}
+
+		if(++song_stream_sector_pos==512){
+			//ignore dummy checksum
+			spi_byte(0xff);
+			spi_byte(0xff);
+			song_stream_state=SONG_STREAM_TOKEN;
+		}
+	}
+}
+
+/*
+ * Stops the stream and releases the card so the game can read other
+ * files from it, the music holds until ResumeSongStream(). The VSYNC
+ * handler leaves the card alone as soon as the flag is set.
+ */
+void PauseSongStream(){
+	song_stream_paused=true;
+	song_stream_resume=song_stream_state!=SONG_STREAM_STOPPED;
+	SongStreamStop();
+}
+
+//reopens the stream where the player stopped reading
+void ResumeSongStream(){
+	if(song_stream_resume) SongStreamSeek(song_stream_offset);
+	song_stream_paused=false;
+}
+
+void GetSongStreamStats(struct SongStreamStats *stats){
+	*stats=song_stream_stats;
+}
+
+#endif //SONG_STREAMING == 1
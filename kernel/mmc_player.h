@@ -145,7 +145,7 @@
 	u8   mmc_playerGetStatus();
 	u32  mmc_playerGetCurrentSector();
 	void mmc_playerProcess();
-	u8   mmc_masterInit();
+	u8   mmc_masterInit(u8 *buffer); //512 bytes, used until mmc_listDir() returns
 
 	u8 mmc_listDir(mmc_File* files, u8 count, const char* extfilter);
 
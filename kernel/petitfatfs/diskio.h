@@ -7,6 +7,15 @@
 #include "integer.h"
 
 
+/* 1: disk_readp keeps a multiple block read (CMD18) open between calls, so
+   reading on in the same or the next sector needs no new command. The card
+   stays selected until a read elsewhere or disk_stop(), call that before
+   anything else uses the SPI bus or the card. */
+#ifndef _DISK_READAHEAD
+	#define _DISK_READAHEAD	0
+#endif
+
+
 /* Status of Disk Functions */
 typedef BYTE	DSTATUS;
 
@@ -26,6 +35,14 @@ typedef enum {
 DSTATUS disk_initialize (void);
 DRESULT disk_readp (BYTE*, DWORD, WORD, WORD);
 DRESULT disk_writep (const BYTE*, DWORD);
+#if _DISK_READAHEAD
+void disk_stop (void);
+#else
+#define disk_stop()
+#endif
+
+/* Read commands avoided and issued by disk_readp */
+extern WORD disk_rd_hits, disk_rd_misses;
 
 #define STA_NOINIT		0x01	/* Drive not initialized */
 #define STA_NODISK		0x02	/* No medium in the drive */
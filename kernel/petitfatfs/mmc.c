@@ -43,8 +43,10 @@ extern void WaitUs(unsigned int delay);
 #define CMD1	(0x40+1)	/* SEND_OP_COND (MMC) */
 #define	ACMD41	(0xC0+41)	/* SEND_OP_COND (SDC) */
 #define CMD8	(0x40+8)	/* SEND_IF_COND */
+#define CMD12	(0x40+12)	/* STOP_TRANSMISSION */
 #define CMD16	(0x40+16)	/* SET_BLOCKLEN */
 #define CMD17	(0x40+17)	/* READ_SINGLE_BLOCK */
+#define CMD18	(0x40+18)	/* READ_MULTIPLE_BLOCK */
 #define CMD24	(0x40+24)	/* WRITE_BLOCK */
 #define CMD55	(0x40+55)	/* APP_CMD */
 #define CMD58	(0x40+58)	/* READ_OCR */
@@ -123,6 +125,16 @@ BYTE CardType;
 
 u8 tokenWait;
 
+/* Read commands avoided and issued by disk_readp */
+WORD disk_rd_hits, disk_rd_misses;
+
+#if _DISK_READAHEAD
+static BYTE StreamOn;		/* A multiple block read is open */
+static BYTE StreamToken;	/* The data token of StreamSect is still to come */
+static WORD StreamOfs;		/* Bytes of StreamSect already received */
+static DWORD StreamSect;	/* Sector the card is sending */
+#endif
+
 /*-----------------------------------------------------------------------*/
 /* Send a command packet to MMC                                          */
 /*-----------------------------------------------------------------------*/
@@ -142,11 +154,13 @@ BYTE send_cmd (
 		if (res > 1) return res;
 	}
 
-	/* Select the card */
-	DESELECT();
-	rcv_spi();
-	SELECT();
-	rcv_spi();
+	/* Select the card, it stays selected to stop a multiple block read */
+	if (cmd != CMD12) {
+		DESELECT();
+		rcv_spi();
+		SELECT();
+		rcv_spi();
+	}
 
 	/* Send a command packet */
 	xmit_spi(cmd);						/* Start + Command index */
@@ -158,6 +172,7 @@ BYTE send_cmd (
 	if (cmd == CMD0) n = 0x95;			/* Valid CRC for CMD0(0) */
 	if (cmd == CMD8) n = 0x87;			/* Valid CRC for CMD8(0x1AA) */
 	xmit_spi(n);
+	if (cmd == CMD12) rcv_spi();		/* Skip the stuff byte following CMD12 */
 
 	/* Receive a command response */
 	n = 10;								/* Wait for a valid response in timeout of 10 attempts */
@@ -190,6 +205,10 @@ DSTATUS disk_initialize (void)
 	if (CardType && MMC_SEL) disk_writep(0, 0);	/* Finalize write process if it is in progress */
 #endif
 
+#if _DISK_READAHEAD
+	StreamOn = 0;	/* The card is reset, any open read is gone */
+#endif
+
 	init_spi();		/* Initialize ports to control MMC */
 	DESELECT();
 	for (n = 100; n; n--) rcv_spi();	/* 80*10 dummy clocks with CS=H */
@@ -243,6 +262,106 @@ DSTATUS disk_initialize (void)
 /* Read partial sector                                                   */
 /*-----------------------------------------------------------------------*/
 
+#if _DISK_READAHEAD
+DRESULT disk_readp (
+	BYTE *buff,		/* Pointer to the read buffer (NULL:Read bytes are forwarded to the stream) */
+	DWORD lba,		/* Sector number (LBA) */
+	WORD ofs,		/* Byte offset to read from (0..511) */
+	WORD cnt		/* Number of bytes to read (ofs + cnt mus be <= 512) */
+)
+{
+	BYTE rc;
+	WORD bc;
+
+
+	/* The next sector follows in the stream, skip the rest of this one and its CRC */
+	if (StreamOn && !StreamToken && lba == StreamSect + 1) {
+		bc = 514 - StreamOfs;
+		do rcv_spi(); while (--bc);
+		StreamSect++;
+		StreamToken = 1;
+		StreamOfs = 0;
+	}
+
+	if (StreamOn && lba == StreamSect && ofs >= StreamOfs) {
+		disk_rd_hits++;					/* The data is still ahead in the stream */
+	} else {
+		disk_stop();
+		disk_rd_misses++;
+		if (send_cmd(CMD18, (CardType & CT_BLOCK) ? lba : lba * 512) != 0) {	/* READ_MULTIPLE_BLOCK */
+			DESELECT();
+			rcv_spi();
+			return RES_ERROR;
+		}
+		StreamOn = 1;
+		StreamToken = 1;
+		StreamOfs = 0;
+		StreamSect = lba;
+	}
+
+	if (StreamToken) {
+		bc = 40000;
+		do {							/* Wait for data packet */
+			rc = rcv_spi();
+		} while (rc == 0xFF && --bc);
+		if (rc != 0xFE) {
+			disk_stop();
+			return RES_ERROR;
+		}
+		StreamToken = 0;
+	}
+
+	/* Skip leading bytes */
+	bc = ofs - StreamOfs;
+	while (bc--) rcv_spi();
+	StreamOfs = ofs + cnt;
+
+	/* Receive a part of the sector */
+	if (buff) {	/* Store data to the memory */
+		do {
+			*buff++ = rcv_spi();
+		} while (--cnt);
+	} else {	/* Forward data to the outgoing stream (depends on the project) */
+		do {
+			FORWARD(rcv_spi());
+		} while (--cnt);
+	}
+
+	/* End of the sector, skip its CRC and wait for the next one */
+	if (StreamOfs == 512) {
+		rcv_spi();
+		rcv_spi();
+		StreamSect++;
+		StreamToken = 1;
+		StreamOfs = 0;
+	}
+
+	return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Stop the read-ahead and release the card                              */
+/*-----------------------------------------------------------------------*/
+
+void disk_stop (void)
+{
+	WORD bc;
+
+
+	if (StreamOn) {
+		StreamOn = 0;
+		send_cmd(CMD12, 0);				/* STOP_TRANSMISSION */
+		bc = 40000;
+		while (rcv_spi() != 0xFF && --bc) ;	/* Wait for the card to leave busy state */
+	}
+
+	DESELECT();
+	rcv_spi();
+}
+
+#else
 DRESULT disk_readp (
 	BYTE *buff,		/* Pointer to the read buffer (NULL:Read bytes are forwarded to the stream) */
 	DWORD lba,		/* Sector number (LBA) */
@@ -257,6 +376,7 @@ DRESULT disk_readp (
 
 
 	if (!(CardType & CT_BLOCK)) lba *= 512;		/* Convert to byte address if needed */
+	disk_rd_misses++;
 
 	res = RES_ERROR;
 	if (send_cmd(CMD17, lba) == 0) {		/* READ_SINGLE_BLOCK */
@@ -302,6 +422,8 @@ DRESULT disk_readp (
 	return res;
 }
 
+#endif
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -330,6 +452,9 @@ DRESULT disk_writep (
 	} else {
 		if (sa) {	/* Initiate sector write process */
 			if (!(CardType & CT_BLOCK)) sa *= 512;	/* Convert to byte address if needed */
+#if _DISK_READAHEAD
+			disk_stop();
+#endif
 			if (send_cmd(CMD24, sa) == 0) {			/* WRITE_SINGLE_BLOCK */
 				xmit_spi(0xFF); xmit_spi(0xFE);		/* Data block header */
 				wc = 512;							/* Set byte counter */
@@ -329,6 +329,25 @@ static
 FATFS *FatFs;	/* Pointer to the file system object (logical drive) */
 
 
+#if _FS_DIR_CACHE
+/* Directory entry remembered by dir_find */
+typedef struct {
+	CLUST	dclust;		/* Directory the entry is in (0:Root) */
+	BYTE	name[11];	/* SFN of the entry (name[0] == 0:Free) */
+	BYTE	attr;		/* Attribute */
+	CLUST	sclust;		/* Start cluster */
+	DWORD	fsize;		/* File size */
+} DIRCACHE;
+
+static
+DIRCACHE DirCache[_FS_DIR_CACHE];
+static
+BYTE DirCacheNext;	/* Entry to replace next */
+static
+WORD DirHits, DirMisses;
+#endif
+
+
 /* Fill memory */
 static
 void mem_set (void* dst, int val, int cnt) {
@@ -336,6 +355,16 @@ void mem_set (void* dst, int val, int cnt) {
 	while (cnt--) *d++ = (char)val;
 }
 
+#if _FS_DIR_CACHE
+/* Copy memory to memory */
+static
+void mem_cpy (void* dst, const void* src, int cnt) {
+	char *d = (char*)dst;
+	const char *s = (const char *)src;
+	while (cnt--) *d++ = *s++;
+}
+#endif
+
 /* Compare memory to memory */
 static
 int mem_cmp (const void* dst, const void* src, int cnt) {
@@ -499,6 +528,28 @@ FRESULT dir_find (
 {
 	FRESULT res;
 	BYTE c;
+#if _FS_DIR_CACHE
+	DIRCACHE *dc;
+
+
+	/* Rebuild the entry from the cache, only the fields the callers use */
+	for (c = 0; c < _FS_DIR_CACHE; c++) {
+		dc = &DirCache[c];
+		if (dc->name[0] && dc->dclust == dj->sclust && !mem_cmp(dc->name, dj->fn, 11)) {
+			mem_set(dir, 0, 32);
+			mem_cpy(dir, dc->name, 11);
+			dir[DIR_Attr] = dc->attr;
+			ST_WORD(dir+DIR_FstClusLO, dc->sclust);
+#if _FS_FAT32
+			ST_WORD(dir+DIR_FstClusHI, dc->sclust >> 16);
+#endif
+			ST_DWORD(dir+DIR_FileSize, dc->fsize);
+			DirHits++;
+			return FR_OK;
+		}
+	}
+	DirMisses++;
+#endif
 
 
 	res = dir_rewind(dj);			/* Rewind directory object */
@@ -519,6 +570,18 @@ FRESULT dir_find (
 		res = dir_next(dj);					/* Next entry */
 	} while (res == FR_OK);
 
+#if _FS_DIR_CACHE
+	if (res == FR_OK) {						/* Remember it in place of the oldest entry */
+		dc = &DirCache[DirCacheNext];
+		if (++DirCacheNext == _FS_DIR_CACHE) DirCacheNext = 0;
+		dc->dclust = dj->sclust;
+		mem_cpy(dc->name, dir, 11);
+		dc->attr = dir[DIR_Attr];
+		dc->sclust = LD_CLUST(dir);
+		dc->fsize = LD_DWORD(dir+DIR_FileSize);
+	}
+#endif
+
 	return res;
 }
 
@@ -752,6 +815,9 @@ FRESULT pf_mount (
 
 
 	FatFs = 0;
+#if _FS_DIR_CACHE
+	mem_set(DirCache, 0, sizeof(DirCache));	/* Entries of the previous card are stale */
+#endif
 	if (!fs) return FR_OK;				/* Unregister fs object */
 
 	if (disk_initialize() & STA_NOINIT)	/* Check if the drive is ready or not */
@@ -1147,3 +1213,24 @@ FRESULT pf_readdir (
 
 #endif /* _FS_USE_DIR */
 
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get the Cache Statistics                                              */
+/*-----------------------------------------------------------------------*/
+
+void pf_getstats (
+	PFSTAT *st		/* Pointer to the statistics to fill */
+)
+{
+#if _FS_DIR_CACHE
+	st->dir_hits = DirHits;
+	st->dir_misses = DirMisses;
+#else
+	st->dir_hits = 0;
+	st->dir_misses = 0;
+#endif
+	st->rd_hits = disk_rd_hits;
+	st->rd_misses = disk_rd_misses;
+}
@@ -42,6 +42,12 @@
 	#define	_FS_USE_WRITE	1	/* 1:Enable pf_write() */
 #endif
 
+#ifndef _FS_DIR_CACHE
+	#define	_FS_DIR_CACHE	0	/* Number of directory entries remembered by pf_open(), 0:Disable */
+#endif
+/* Each cached entry takes 20 bytes of RAM. A hit skips the directory walk,
+/  the cache is emptied by pf_mount(). */
+
 #define _FS_FAT12	0	/* 1:Enable FAT12 support */
 #define _FS_FAT32	0	/* 1:Enable FAT32 support */
 
@@ -124,6 +130,17 @@ typedef struct {
 
 
 
+/* Cache statistics (pf_getstats) */
+
+typedef struct {
+	WORD	dir_hits;	/* Directory entries found in the cache */
+	WORD	dir_misses;	/* Directory walks */
+	WORD	rd_hits;	/* Sector reads served by the open read-ahead */
+	WORD	rd_misses;	/* Read commands sent to the card */
+} PFSTAT;
+
+
+
 /* File function return code (FRESULT) */
 
 typedef enum {
@@ -149,6 +166,7 @@ FRESULT pf_write (const void*, WORD, WORD*);	/* Write data to the open file */
 FRESULT pf_lseek (DWORD);						/* Move file pointer of the open file */
 FRESULT pf_opendir (DIR*, const char*);			/* Open a directory */
 FRESULT pf_readdir (DIR*, FILINFO*);			/* Read a directory item from the open directory */
+void pf_getstats (PFSTAT*);						/* Get the cache statistics */
 
 
 
@@ -302,6 +302,64 @@ ch4_end:
 	add r28,r1	;add (sample*vol>>8) to mix buffer lsb
 	adc r29,r0	;adjust mix buffer msb	
 ;186	
+
+#elif UART_RX_BUFFER == 1 || UART_TX_BUFFER == 1
+	;UART buffers -- in the slot of channel 5, see UART_MIXER_CYCLES 
+	;constant time: no branches, only single instruction skips
+
+	lds r17,_SFR_MEM_ADDR(UCSR0A)
+
+	#if UART_RX_BUFFER == 1
+	;receive -- 29 cycles
+	lds r16,uart_rx_buf_end
+	mov ZL,r16
+	ldi ZH,0
+	subi ZL,lo8(-(uart_rx_buf))
+	sbci ZH,hi8(-(uart_rx_buf))
+
+	sbrc r17,RXC0				;reading UDR0 pops the byte, only read
+	lds r0,_SFR_MEM_ADDR(UDR0)	;what the flags we got say is there
+	st Z,r0						;slot past the end, free even when full
+
+	inc r16
+	andi r16,(UART_RX_BUFFER_SIZE-1) ;wrap
+	lds r18,uart_rx_buf_start
+
+	clr r0
+	cpse r16,r18				;full if the next end is the start
+	com r0
+	and r0,r17					;r0.RXC0=received and room
+	sbrc r0,RXC0
+	sts uart_rx_buf_end,r16
+
+	eor r0,r17					;r0.RXC0=received and full
+	lds r16,uart_rx_overflows
+	sbrc r0,RXC0
+	inc r16
+	sts uart_rx_overflows,r16
+	#endif
+
+	#if UART_TX_BUFFER == 1
+	;transmit -- 22 cycles
+	lds r16,uart_tx_buf_start
+	lds r18,uart_tx_buf_end
+	mov ZL,r16
+	ldi ZH,0
+	subi ZL,lo8(-(uart_tx_buf))
+	sbci ZH,hi8(-(uart_tx_buf))
+	ld r0,Z
+
+	clr ZL
+	cpse r16,r18				;empty if the start is the end
+	com ZL
+	and ZL,r17					;ZL.UDRE0=data and UART ready
+	sbrc ZL,UDRE0
+	sts _SFR_MEM_ADDR(UDR0),r0
+	sbrc ZL,UDRE0
+	inc r16
+	andi r16,(UART_TX_BUFFER_SIZE-1) ;wrap
+	sts uart_tx_buf_start,r16
+	#endif
 #endif
 	
 	;final processing
@@ -35,6 +35,7 @@
 	 */
 	extern void FadeIn(unsigned char speed,bool blocking);
 	extern void FadeOut(unsigned char speed,bool blocking);
+	extern bool IsFadeActive(void);
 	extern void SetSpritesOptions(unsigned char params);
 	extern void SetSpritesTileTable(const char *data);
 
@@ -92,8 +93,14 @@
 	extern   u8 GetMasterVolume();
 	extern void TriggerNote(unsigned char channel,unsigned char patch,unsigned char note,unsigned char volume);
 	extern void TriggerFx(unsigned char patch,unsigned char volume, bool retrig); //uses a simple voice stealing algorithm
+	extern u8 TriggerFxPriority(u8 patch,u8 volume,u8 priority); //steals the lowest priority voice
+	extern u16 GetMusicCycles(bool worst); //use only if SOUND_ENGINE_PROFILE=1
 	extern void StopSong();
 	extern void StartSong(const char *midiSong);
+	extern void StartSongStream(u32 firstSector); //use only if SONG_STREAMING=1
+	extern void GetSongStreamStats(struct SongStreamStats *stats);
+	extern void PauseSongStream(); //lends the card to other code, use only if SONG_STREAMING=1
+	extern void ResumeSongStream();
 	extern void ResumeSong();
 	extern void InitMusicPlayer(const struct PatchStruct *patchPointersParam);
 	extern void EnableSoundEngine();
@@ -121,6 +128,14 @@
 	extern unsigned char DetectControllers();
 	void ReadControllers(); //use only if CONTROLLERS_VSYNC_READ=0
 
+	#define INPUT_PRESS 0
+	#define INPUT_RELEASE 1
+	#define INPUT_REPEAT 2
+
+	extern bool GetInputEvent(struct InputEvent *event); //use only if INPUT_EVENTS=1
+	extern void SetInputRepeat(u8 delay,u8 rate,u16 buttons);
+	extern void ClearInputEvents(void);
+
 
 	/*
 	 * EEPROM functions
@@ -132,19 +147,40 @@
 	extern bool isEepromFormatted();
 	extern void FormatEeprom(void);
 	extern void FormatEeprom2(u16 *ids, u8 count);
+	extern void EepromDirLoad(void);
+	extern char EepromJournalOpen(struct EepromJournal *journal,unsigned int baseId,u8 slots,unsigned char *data);
+	extern char EepromJournalSave(struct EepromJournal *journal,unsigned char *data);
+
+	/*
+	 * Random numbers
+	 */
+	extern void RngSeed(struct Rng *rng,u32 seed);
+	extern u16  RngNext(struct Rng *rng);
+	extern u8   RngRange(struct Rng *rng,u8 count); //0 to count-1
+	extern void RngJump(struct Rng *rng,u32 steps);
+	extern char EepromWriteBlockAsync(struct EepromBlockStruct *block);
+	extern u8 EepromWritePending(void);
+	extern void EepromWriteFlush(void);
 
 
 	/*
-	 * UART RX buffer
+	 * UART RX/TX buffers
 	 */
 	extern void UartInitRxBuffer();
 	extern void UartGoBack(unsigned char count);
 	extern unsigned char UartUnreadCount();
 	extern unsigned char UartReadChar();
+	extern u8 UartReadPacket(u8 *data,u8 max); //payload length, 0 if none yet
+	extern void UartInitTxBuffer();
+	extern bool UartSendChar(u8 data); //false if the buffer is full
+	extern u8 UartTxFreeCount();
+	extern bool UartSendPacket(const u8 *data,u8 len);
+	extern void GetUartStats(struct UartStats *stats);
 
 	/*
 	 * Misc functions
 	 */
+	extern u16 StackFree(void); //use only if STACK_MONITOR=1
 	extern void WaitClocks(u16 clocks);
 	extern void WaitUs(unsigned int microseconds);
 	extern void SoftReset(void);
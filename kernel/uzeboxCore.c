@@ -24,10 +24,16 @@
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
+#include <util/crc16.h>
 #include "uzebox.h"
 
-#define Wait200ns() asm volatile("lpm\n\tlpm\n\t");
-#define Wait100ns() asm volatile("lpm\n\t");
+#ifdef __AVR__
+	#define Wait200ns() asm volatile("lpm\n\tlpm\n\t");
+	#define Wait100ns() asm volatile("lpm\n\t");
+#else
+	#define Wait200ns()		//host builds (tools/host/core.c) have no bus timing
+	#define Wait100ns()
+#endif
 
 //Callbacks defined in each video modes module
 extern void DisplayLogo(); 
@@ -35,6 +41,7 @@ extern void InitializeVideoMode();
 extern void InitSoundPort();
 
 void ReadButtons();
+void ProcessInputEvents(void);
 
 extern unsigned char sync_phase;
 extern unsigned char sync_pulse;
@@ -58,6 +65,39 @@ extern unsigned char sound_enabled;
 
 u8 joypadsConnectionStatus;
 
+#if EEPROM_WRITE_QUEUE == 1
+	struct EepromQueueEntry{
+		u16 addr;	//EEPROM address of the block
+		u8 pos;		//next byte of the block to write
+		struct EepromBlockStruct block;
+	};
+
+	struct EepromQueueEntry eeprom_queue[EEPROM_WRITE_QUEUE_SIZE];
+	volatile u8 eeprom_queue_head;	//entry being written
+	volatile u8 eeprom_queue_count;
+	volatile u8 eeprom_queue_hold;	//set while the main program accesses the EEPROM
+#endif
+
+#if INPUT_EVENTS == 1
+	struct InputEvent input_queue[INPUT_EVENTS_QUEUE_SIZE];
+	volatile u8 input_queue_head;	//next event to read
+	volatile u8 input_queue_tail;	//next free entry
+	u16 input_frame;
+	u16 input_prev[2];				//buttons held on the previous read
+	u8 input_repeat_timer[2];
+	u8 input_repeat_delay=INPUT_REPEAT_DELAY;
+	u8 input_repeat_rate=INPUT_REPEAT_RATE;
+	u16 input_repeat_buttons=BTN_UP|BTN_DOWN|BTN_LEFT|BTN_RIGHT;
+#endif
+
+#if EEPROM_DIRECTORY == 1
+	u8 eeprom_dir[EEPROM_DIR_SIZE];		//hashed block id -> block number, 0=empty
+	u16 eeprom_dir_id[EEPROM_DIR_SIZE];	//id of that block, probes don't read the EEPROM
+	u8 eeprom_dir_free[(EEPROM_BLOCKS_COUNT+7)/8];	//bit set if the block is free
+
+	#define EepromDirHash(id) (((id)^((id)>>8))&(EEPROM_DIR_SIZE-1))
+#endif
+
 
 const u8 eeprom_format_table[] PROGMEM ={(u8)EEPROM_SIGNATURE,		//(u16)
 								   (u8)(EEPROM_SIGNATURE>>8),	//
@@ -114,6 +154,8 @@ void SetRenderingParameters(u8 firstScanlineToRender, u8 scanlinesToRender){
 #define io_set(a,b) ((_SFR_MEM_ADDR(a) & 0xff) + ((b)<<8))
 #define set_io_end  0x0001
 
+#define UART_UBRR ((F_CPU+UART_BAUD_RATE*4UL)/(UART_BAUD_RATE*8UL)-1) //rounded, U2X0 set
+
 const u16 io_table[] PROGMEM ={
 	io_set(TCCR1B,0x00),	//stop timers
 	io_set(TCCR0B,0x00),
@@ -130,6 +172,12 @@ const u16 io_table[] PROGMEM ={
 	io_set(UCSR0B,(1<<RXEN0)), //set UART for MIDI in
 	io_set(UCSR0C,(1<<UCSZ01)+(1<<UCSZ00)),
 	io_set(UBRR0L,56), //31250 bauds (.5% error)
+#elif UART_RX_BUFFER == 1 || UART_TX_BUFFER == 1
+	io_set(UCSR0A,(1<<U2X0)), //double speed, 115200 bauds is only .2% off
+	io_set(UCSR0B,(UART_RX_BUFFER<<RXEN0)+(UART_TX_BUFFER<<TXEN0)),
+	io_set(UCSR0C,(1<<UCSZ01)+(1<<UCSZ00)),
+	io_set(UBRR0H,UART_UBRR>>8),
+	io_set(UBRR0L,UART_UBRR&0xff),
 #endif
 	
 	//clear timers
@@ -164,6 +212,9 @@ void Initialize(void){
 	int i;
 
 	if(!isEepromFormatted()) FormatEeprom();
+	#if EEPROM_DIRECTORY == 1
+		else EepromDirLoad();
+	#endif
 
 	cli();
 	
@@ -193,6 +244,11 @@ void Initialize(void){
 		uart_rx_buf_end=0;
 	#endif
 
+	#if UART_TX_BUFFER == 1
+		uart_tx_buf_start=0;
+		uart_tx_buf_end=0;
+	#endif
+
 
 	#if SNES_MOUSE == 1
 		snesMouseEnabled=false;
@@ -320,8 +376,106 @@ void ReadControllers(){
 			
 	//read the standard buttons
 	ReadButtons();
+
+	#if INPUT_EVENTS == 1
+		ProcessInputEvents();
+	#endif
+}
+
+#if INPUT_EVENTS == 1
+static void PushInputEvent(u8 type,u8 joypad,u16 button){
+	u8 tail=input_queue_tail;
+	struct InputEvent *event;
+
+	//drop the event if the queue is full
+	if(((tail+1)&(INPUT_EVENTS_QUEUE_SIZE-1))==input_queue_head) return;
+
+	event=&input_queue[tail];
+	event->type=type;
+	event->joypad=joypad;
+	event->button=button;
+	event->frame=input_frame;
+	input_queue_tail=(tail+1)&(INPUT_EVENTS_QUEUE_SIZE-1);
+}
+
+/*
+ * Compares the buttons just read with the previous read and
+ * queues an event for each button that changed. Buttons in the
+ * repeat mask that stay held emit repeat events.
+ */
+void ProcessInputEvents(void){
+	u8 p;
+	u16 cur,changed,held,bit;
+
+	input_frame++;
+
+	for(p=0;p<2;p++){
+		cur=(p==0?joypad1_status_lo:joypad2_status_lo);
+
+		//bit 15 is set by the SNES mouse, there are no buttons to report
+		if(cur&(1<<15)) cur=0;
+
+		changed=cur^input_prev[p];
+		held=cur&input_repeat_buttons;
+
+		//a new press on a repeatable button restarts the delay
+		if(changed&held) input_repeat_timer[p]=input_repeat_delay;
+
+		for(bit=1;changed!=0;bit<<=1){
+			if(changed&bit){
+				PushInputEvent((cur&bit)?INPUT_PRESS:INPUT_RELEASE,p,bit);
+				changed&=~bit;
+			}
+		}
+
+		if(held!=0 && input_repeat_timer[p]!=0 && --input_repeat_timer[p]==0){
+			for(bit=1;held!=0;bit<<=1){
+				if(held&bit){
+					PushInputEvent(INPUT_REPEAT,p,bit);
+					held&=~bit;
+				}
+			}
+			input_repeat_timer[p]=input_repeat_rate;
+		}
+
+		input_prev[p]=cur;
+	}
 }
 
+/*
+ * Fetches the oldest buffered input event.
+ *
+ * Returns: true if an event was copied in 'event', false if the queue is empty
+ */
+bool GetInputEvent(struct InputEvent *event){
+	u8 head=input_queue_head;
+
+	if(head==input_queue_tail) return false;
+
+	*event=input_queue[head];
+	input_queue_head=(head+1)&(INPUT_EVENTS_QUEUE_SIZE-1);
+	return true;
+}
+
+/*
+ * Sets the auto-repeat of held buttons. 'delay' is the number of frames
+ * before the first repeat, 'rate' the number of frames between the next ones.
+ * 'buttons' is the mask of buttons that repeat, 0 disables auto-repeat.
+ */
+void SetInputRepeat(u8 delay,u8 rate,u16 buttons){
+	input_repeat_delay=delay;
+	input_repeat_rate=rate;
+	input_repeat_buttons=buttons;
+}
+
+/*
+ * Discards all buffered input events.
+ */
+void ClearInputEvents(void){
+	input_queue_head=input_queue_tail;
+}
+#endif
+
 
 
 
@@ -593,17 +747,24 @@ unsigned char DetectControllers(){
 // Format eeprom, wiping all data to zero
 void FormatEeprom(void) {
 
+   #if EEPROM_WRITE_QUEUE == 1
+	  EepromWriteFlush();
+   #endif
+
    // Set sig. so we don't format next time
    for (u8 i = 0; i < sizeof(eeprom_format_table); i++) {
 	 WriteEeprom(i,pgm_read_byte(&eeprom_format_table[i]));
    }
    
    // Write free blocks IDs
-   for (u16 i = (EEPROM_BLOCK_SIZE*EEPROM_HEADER_SIZE); i < (64*EEPROM_BLOCK_SIZE); i+=EEPROM_BLOCK_SIZE) {
+   for (u16 i = (EEPROM_BLOCK_SIZE*EEPROM_HEADER_SIZE); i < (EEPROM_BLOCKS_COUNT*EEPROM_BLOCK_SIZE); i+=EEPROM_BLOCK_SIZE) {
 	  WriteEeprom(i,(u8)EEPROM_FREE_BLOCK);
 	  WriteEeprom(i+1,(u8)(EEPROM_FREE_BLOCK>>8));
    }
-   
+
+   #if EEPROM_DIRECTORY == 1
+	  EepromDirLoad();
+   #endif
 }
 
 // Format eeprom, saving data specified in ids
@@ -611,13 +772,17 @@ void FormatEeprom2(u16 *ids, u8 count) {
    u8 j;
    u16 id;
 
+   #if EEPROM_WRITE_QUEUE == 1
+	  EepromWriteFlush();
+   #endif
+
    // Set sig. so we don't format next time
    for (u8 i = 0; i < 8; i++) {
 	 WriteEeprom(i,pgm_read_byte(&eeprom_format_table[i]));
    }
 
    // Paint unreserved free blocks
-   for (int i = EEPROM_HEADER_SIZE; i < 64; i++) {
+   for (int i = EEPROM_HEADER_SIZE; i < EEPROM_BLOCKS_COUNT; i++) {
 	  id=ReadEeprom(i*EEPROM_BLOCK_SIZE)+(ReadEeprom((i*EEPROM_BLOCK_SIZE)+1)<<8);
 
 	  for (j = 0; j < count; j++) {
@@ -630,12 +795,23 @@ void FormatEeprom2(u16 *ids, u8 count) {
 		 WriteEeprom(i*EEPROM_BLOCK_SIZE+1,(u8)(EEPROM_FREE_BLOCK>>8));
 	  }
    }
+
+   #if EEPROM_DIRECTORY == 1
+	  EepromDirLoad();
+   #endif
 }
 	
 //returns true if the EEPROM has been setup to work with the kernel.
 bool isEepromFormatted(){
 	unsigned id;
+	#if EEPROM_WRITE_QUEUE == 1
+		u8 hold=eeprom_queue_hold;
+		eeprom_queue_hold=1;
+	#endif
 	id=ReadEeprom(0)+(ReadEeprom(1)<<8);
+	#if EEPROM_WRITE_QUEUE == 1
+		eeprom_queue_hold=hold;
+	#endif
 	return (id==EEPROM_SIGNATURE);
 }
 
@@ -648,41 +824,253 @@ u8 ReadPowerSwitch(){
 	return !((PIND&((1<<PD3)+(1<<PD2)))==((1<<PD3)+(1<<PD2)));
 }
 
+/*
+ * Returns: the id of a block. A block claimed by a queued write that
+ * has not reached the EEPROM yet returns the queued id.
+ */
+static unsigned int EepromBlockId(u8 block){
+	#if EEPROM_WRITE_QUEUE == 1
+		u8 i,e;
+		for(i=0;i<eeprom_queue_count;i++){
+			e=eeprom_queue_head+i;
+			if(e>=EEPROM_WRITE_QUEUE_SIZE) e-=EEPROM_WRITE_QUEUE_SIZE;
+			if(eeprom_queue[e].addr==block*EEPROM_BLOCK_SIZE) return eeprom_queue[e].block.id;
+		}
+	#endif
+	return ReadEeprom(block*EEPROM_BLOCK_SIZE)+(ReadEeprom((block*EEPROM_BLOCK_SIZE)+1)<<8);
+}
+
+#if EEPROM_DIRECTORY == 1
+static void EepromDirInsert(unsigned int id,u8 block){
+	u8 h=EepromDirHash(id);
+	while(eeprom_dir[h]!=0) h=(h+1)&(EEPROM_DIR_SIZE-1);
+	eeprom_dir[h]=block;
+	eeprom_dir_id[h]=id;
+	eeprom_dir_free[block>>3]&=~(1<<(block&7));
+}
+
+/*
+ * Builds the RAM directory of the EEPROM blocks. Called once by the kernel
+ * at startup and after formatting, every other block lookup uses it.
+ */
+void EepromDirLoad(void){
+	u8 i;
+	unsigned int id;
+
+	for(i=0;i<EEPROM_DIR_SIZE;i++) eeprom_dir[i]=0;
+	for(i=0;i<sizeof(eeprom_dir_free);i++) eeprom_dir_free[i]=0;
+
+	if(!isEepromFormatted()) return;
+
+	for(i=EEPROM_HEADER_SIZE;i<EEPROM_BLOCKS_COUNT;i++){
+		id=EepromBlockId(i);
+		if(id==EEPROM_FREE_BLOCK){
+			eeprom_dir_free[i>>3]|=(1<<(i&7));
+		}else{
+			EepromDirInsert(id,i);
+		}
+	}
+}
+
+/*
+ * Returns: the block number holding that id, 0 if there's none.
+ */
+static u8 EepromDirFind(unsigned int id){
+	u8 h=EepromDirHash(id),n;
+
+	for(n=0;n<EEPROM_DIR_SIZE;n++){
+		if(eeprom_dir[h]==0) return 0;
+		if(eeprom_dir_id[h]==id) return eeprom_dir[h];
+		h=(h+1)&(EEPROM_DIR_SIZE-1);
+	}
+	return 0;
+}
+
+/*
+ * Returns: the first free block number, 0 if the EEPROM is full.
+ */
+static u8 EepromDirFree(void){
+	u8 i,j;
+	for(i=0;i<sizeof(eeprom_dir_free);i++){
+		if(eeprom_dir_free[i]==0) continue;
+		for(j=0;j<8;j++){
+			if(eeprom_dir_free[i]&(1<<j)) return (i<<3)+j;
+		}
+	}
+	return 0;
+}
+#endif
+
+/*
+ * Finds the address of the specified block id or claims the first free block for it.
+ *
+ * Returns: the address or 0 if the block was not found and the EEPROM is full.
+ */
+static unsigned int EepromGetWriteAddr(unsigned int blockId){
+	unsigned char i;
+
+	#if EEPROM_DIRECTORY == 1
+		i=EepromDirFind(blockId);
+		if(i==0){
+			i=EepromDirFree();
+			if(i==0) return 0;
+			EepromDirInsert(blockId,i);
+		}
+		return i*EEPROM_BLOCK_SIZE;
+	#else
+		unsigned char nextFreeBlock=0;
+		unsigned int id;
+
+		//scan all blocks and get the adress of that block or the next free one.
+		for(i=EEPROM_HEADER_SIZE;i<EEPROM_BLOCKS_COUNT;i++){
+			id=EepromBlockId(i);
+			if(id==blockId){
+				return i*EEPROM_BLOCK_SIZE;
+			}
+			if(id==EEPROM_FREE_BLOCK && nextFreeBlock==0) nextFreeBlock=i;
+		}
+
+		return nextFreeBlock*EEPROM_BLOCK_SIZE;
+	#endif
+}
+
 /*
  * Write a data block in the specified block id. If the block does not exist, it is created.
+ * Only the bytes that changed are written.
  *
  * Returns: 0 on success or error codes
  */
 char EepromWriteBlock(struct EepromBlockStruct *block){
-	unsigned char i,nextFreeBlock=0,c;
-	unsigned int destAddr=0,id;
+	unsigned char i,c;
+	unsigned int destAddr;
 	unsigned char *srcPtr=(unsigned char *)block;
 
+	#if EEPROM_WRITE_QUEUE == 1
+		//a queued copy of this block would overwrite us later
+		EepromWriteFlush();
+	#endif
+
 	if(!isEepromFormatted()) return EEPROM_ERROR_NOT_FORMATTED;
 	if(block->id==EEPROM_FREE_BLOCK || block->id==EEPROM_SIGNATURE) return EEPROM_ERROR_INVALID_BLOCK;
 
-	//scan all blocks and get the adress of that block or the next free one.
-	for(i=EEPROM_HEADER_SIZE;i<64;i++){
-		id=ReadEeprom(i*EEPROM_BLOCK_SIZE)+(ReadEeprom((i*EEPROM_BLOCK_SIZE)+1)<<8);
-		if(id==block->id){
-			destAddr=i*EEPROM_BLOCK_SIZE;
-			break;
-		}
-		if(id==0xffff && nextFreeBlock==0) nextFreeBlock=i;
-	}
-
-	if(destAddr==0 && nextFreeBlock==0) return EEPROM_ERROR_FULL;
-	if(nextFreeBlock!=0) destAddr=nextFreeBlock*EEPROM_BLOCK_SIZE;
+	destAddr=EepromGetWriteAddr(block->id);
+	if(destAddr==0) return EEPROM_ERROR_FULL;
 
 	for(i=0;i<EEPROM_BLOCK_SIZE;i++){
 		c=*srcPtr;
-		WriteEeprom(destAddr++,c);
+		if(ReadEeprom(destAddr)!=c) WriteEeprom(destAddr,c);
+		destAddr++;
 		srcPtr++;	
 	}
 	
 	return 0;
 }
 
+#if EEPROM_WRITE_QUEUE == 1
+/*
+ * Queues a data block to be written in the specified block id. If the block does not exist, it is created.
+ * The block is copied, so the caller may modify it right away. If the same block is already
+ * queued, its data is replaced and writing restarts from the first byte.
+ *
+ * The bytes are written one per VSYNC by ProcessEepromQueue(), skipping the ones
+ * that already hold the right value. Use EepromWritePending() to check for completion.
+ *
+ * Returns: 0 on success or error codes
+ *  0x01 = EEPROM_ERROR_INVALID_BLOCK
+ *	0x02 = EEPROM_ERROR_FULL
+ *	0x04 = EEPROM_ERROR_NOT_FORMATTED
+ *	0x05 = EEPROM_ERROR_QUEUE_FULL
+ */
+char EepromWriteBlockAsync(struct EepromBlockStruct *block){
+	unsigned char i,e=0;
+	unsigned int destAddr;
+	unsigned char *srcPtr=(unsigned char *)block;
+	unsigned char *dstPtr;
+	char ret=0;
+
+	if(block->id==EEPROM_FREE_BLOCK || block->id==EEPROM_SIGNATURE) return EEPROM_ERROR_INVALID_BLOCK;
+
+	eeprom_queue_hold=1;
+
+	if(!isEepromFormatted()){
+		ret=EEPROM_ERROR_NOT_FORMATTED;
+	}else{
+		//look for a queued write of the same block
+		for(i=0;i<eeprom_queue_count;i++){
+			e=eeprom_queue_head+i;
+			if(e>=EEPROM_WRITE_QUEUE_SIZE) e-=EEPROM_WRITE_QUEUE_SIZE;
+			if(eeprom_queue[e].block.id==block->id) break;
+		}
+
+		if(i<eeprom_queue_count){
+			destAddr=eeprom_queue[e].addr;
+		}else if(eeprom_queue_count==EEPROM_WRITE_QUEUE_SIZE){
+			ret=EEPROM_ERROR_QUEUE_FULL;
+		}else if((destAddr=EepromGetWriteAddr(block->id))==0){
+			ret=EEPROM_ERROR_FULL;
+		}else{
+			e=eeprom_queue_head+eeprom_queue_count;
+			if(e>=EEPROM_WRITE_QUEUE_SIZE) e-=EEPROM_WRITE_QUEUE_SIZE;
+			eeprom_queue_count++;
+		}
+
+		if(ret==0){
+			dstPtr=(unsigned char *)&eeprom_queue[e].block;
+			for(i=0;i<EEPROM_BLOCK_SIZE;i++){
+				*dstPtr++=*srcPtr++;
+			}
+			eeprom_queue[e].addr=destAddr;
+			eeprom_queue[e].pos=0;
+		}
+	}
+
+	eeprom_queue_hold=0;
+	return ret;
+}
+
+/*
+ * Returns: the number of queued blocks not completely written yet. 0 when idle.
+ */
+u8 EepromWritePending(void){
+	return eeprom_queue_count;
+}
+
+/*
+ * Waits until all the queued blocks are written.
+ */
+void EepromWriteFlush(void){
+	while(eeprom_queue_count!=0);
+}
+
+/*
+ * Called by the kernel during VSYNC. Starts writing the next byte that
+ * differs once the previous write is complete (EEPE cleared), which happens
+ * ~3.3ms after it started, so a byte per frame never waits on the hardware.
+ */
+void ProcessEepromQueue(void){
+	struct EepromQueueEntry *entry;
+	unsigned char c;
+
+	if(eeprom_queue_count==0 || eeprom_queue_hold) return;
+	if(EECR&(1<<EEPE)) return;
+
+	entry=&eeprom_queue[eeprom_queue_head];
+	while(entry->pos<EEPROM_BLOCK_SIZE){
+		c=((unsigned char *)&entry->block)[entry->pos];
+		if(ReadEeprom(entry->addr+entry->pos)!=c){
+			WriteEeprom(entry->addr+entry->pos,c);
+			entry->pos++;
+			return;
+		}
+		entry->pos++;
+	}
+
+	//block done
+	if(++eeprom_queue_head==EEPROM_WRITE_QUEUE_SIZE) eeprom_queue_head=0;
+	eeprom_queue_count--;
+}
+#endif
+
 /*
  * Reads a data block in the specified structure.
  *
@@ -695,20 +1083,29 @@ char EepromWriteBlock(struct EepromBlockStruct *block){
  */
 char EepromReadBlock(unsigned int blockId,struct EepromBlockStruct *block){
 	unsigned char i;
-	unsigned int destAddr=0xffff,id;
+	unsigned int destAddr=0xffff;
 	unsigned char *destPtr=(unsigned char *)block;
 
+	#if EEPROM_WRITE_QUEUE == 1
+		//a queued copy is newer than what's in the EEPROM
+		EepromWriteFlush();
+	#endif
+
 	if(!isEepromFormatted()) return EEPROM_ERROR_NOT_FORMATTED;
 	if(blockId==EEPROM_FREE_BLOCK) return EEPROM_ERROR_INVALID_BLOCK;
 
-	//scan all blocks and get the adress of that block
-	for(i=0;i<32;i++){
-		id=ReadEeprom(i*EEPROM_BLOCK_SIZE)+(ReadEeprom((i*EEPROM_BLOCK_SIZE)+1)<<8);
-		if(id==blockId){
-			destAddr=i*EEPROM_BLOCK_SIZE;
-			break;
+	#if EEPROM_DIRECTORY == 1
+		i=EepromDirFind(blockId);
+		if(i!=0) destAddr=i*EEPROM_BLOCK_SIZE;
+	#else
+		//scan all blocks and get the adress of that block
+		for(i=EEPROM_HEADER_SIZE;i<EEPROM_BLOCKS_COUNT;i++){
+			if(EepromBlockId(i)==blockId){
+				destAddr=i*EEPROM_BLOCK_SIZE;
+				break;
+			}
 		}
-	}
+	#endif
 
 	if(destAddr==0xffff) return EEPROM_ERROR_BLOCK_NOT_FOUND;			
 
@@ -721,14 +1118,174 @@ char EepromReadBlock(unsigned int blockId,struct EepromBlockStruct *block){
 }
 
 
+static u16 EepromJournalCrc(struct EepromJournalRecord *record){
+	u16 crc=0xffff;
+	unsigned char i;
+	unsigned char *ptr=(unsigned char *)record;
+
+	crc=_crc_ccitt_update(crc,ptr[0]);
+	crc=_crc_ccitt_update(crc,ptr[1]);
+	for(i=0;i<EEPROM_JOURNAL_DATA_SIZE;i++){
+		crc=_crc_ccitt_update(crc,record->data[i]);
+	}
+	return crc;
+}
+
 /*
- * UART Receive buffer function
+ * Opens a journal of 'slots' blocks (ids baseId to baseId+slots-1) and copies the
+ * data of its newest valid record in 'data' (EEPROM_JOURNAL_DATA_SIZE bytes).
+ * A record torn by a power loss fails its CRC and the previous one is used instead.
+ *
+ * Returns:
+ *  0x00 = Success
+ *	0x03 = EEPROM_ERROR_BLOCK_NOT_FOUND, no valid record, 'data' is left untouched
+ *	0x04 = EEPROM_ERROR_NOT_FORMATTED
+ */
+char EepromJournalOpen(struct EepromJournal *journal,unsigned int baseId,u8 slots,unsigned char *data){
+	struct EepromBlockStruct block;
+	struct EepromJournalRecord *record=(struct EepromJournalRecord *)block.data;
+	unsigned char i,j,newest=0xff;
+	u16 newestSeq=0;
+	char ret;
+
+	journal->baseId=baseId;
+	journal->slots=slots;
+	journal->next=0;
+	journal->seq=0;
+
+	for(i=0;i<slots;i++){
+		ret=EepromReadBlock(baseId+i,&block);
+		if(ret==EEPROM_ERROR_NOT_FORMATTED) return ret;
+		if(ret!=0 || EepromJournalCrc(record)!=record->crc) continue;
+
+		//sequence numbers wrap around
+		if(newest==0xff || (s16)(record->seq-newestSeq)>0){
+			newest=i;
+			newestSeq=record->seq;
+			for(j=0;j<EEPROM_JOURNAL_DATA_SIZE;j++){
+				data[j]=record->data[j];
+			}
+		}
+	}
+
+	if(newest==0xff) return EEPROM_ERROR_BLOCK_NOT_FOUND;
+
+	journal->next=(newest+1==slots)?0:newest+1;
+	journal->seq=newestSeq+1;
+	return 0;
+}
+
+/*
+ * Saves 'data' (EEPROM_JOURNAL_DATA_SIZE bytes) in the journal slot after the newest
+ * record, so successive saves rotate over all the slots. The newest record is never
+ * overwritten, if the write is interrupted the previous save is still valid.
+ * Uses the EEPROM write queue when it is enabled.
+ *
+ * Returns: 0 on success or error codes from the block write
+ */
+char EepromJournalSave(struct EepromJournal *journal,unsigned char *data){
+	struct EepromBlockStruct block;
+	struct EepromJournalRecord *record=(struct EepromJournalRecord *)block.data;
+	unsigned char i;
+	char ret;
+
+	block.id=journal->baseId+journal->next;
+	record->seq=journal->seq;
+	for(i=0;i<EEPROM_JOURNAL_DATA_SIZE;i++){
+		record->data[i]=data[i];
+	}
+	record->crc=EepromJournalCrc(record);
+
+	#if EEPROM_WRITE_QUEUE == 1
+		ret=EepromWriteBlockAsync(&block);
+	#else
+		ret=EepromWriteBlock(&block);
+	#endif
+	if(ret!=0) return ret;
+
+	if(++journal->next==journal->slots) journal->next=0;
+	journal->seq++;
+	return 0;
+}
+
+/*
+ * Random numbers, from a 32 bit linear congruential generator.
+ * Its full period of 2^32 lets two streams seeded the same be
+ * split apart with RngJump(), and the jump costs O(log steps).
+ */
+#define RNG_MUL 1664525UL
+#define RNG_ADD 1013904223UL
+
+void RngSeed(struct Rng *rng,u32 seed){
+	rng->state=seed;
+}
+
+//the low bits of the state have short periods, only the high half is used
+u16 RngNext(struct Rng *rng){
+	rng->state=rng->state*RNG_MUL+RNG_ADD;
+	return rng->state>>16;
+}
+
+//scales instead of using a modulo, no division. The 65536 outputs of RngNext()
+//don't split evenly in count values either: some get one output more, at most
+//1/256 more likely, spread over the range instead of all at the low end.
+u8 RngRange(struct Rng *rng,u8 count){
+	return ((u32)RngNext(rng)*count)>>16;
+}
+
+//same as calling RngNext() 'steps' times
+void RngJump(struct Rng *rng,u32 steps){
+	u32 mul=RNG_MUL,add=RNG_ADD,accMul=1,accAdd=0;
+
+	while(steps!=0){
+		if(steps&1){
+			accMul*=mul;
+			accAdd=accAdd*mul+add;
+		}
+		add*=mul+1;
+		mul*=mul;
+		steps>>=1;
+	}
+	rng->state=rng->state*accMul+accAdd;
+}
+
+/*
+ * Stack monitor
+ */
+#if STACK_MONITOR == 1
+
+	extern u8 __bss_end;
+
+	//runs before the variables are initialized, the stack is empty
+	void StackPaint(void) __attribute__((naked,used,section(".init3")));
+	void StackPaint(void){
+		u8 *p=&__bss_end;
+		while(p<(u8*)SP) *p++=STACK_PAINT;
+	}
+
+	/*
+	 * Returns the number of bytes the stack never reached 
+	 * since startup, a low-water mark of the free RAM.
+	 */
+	u16 StackFree(void){
+		u8 *p=&__bss_end;
+		while(*p==STACK_PAINT && p<(u8*)SP) p++;
+		return p-&__bss_end;
+	}
+
+#endif
+
+/*
+ * UART buffers, filled and drained by the mixer on each scanline
+ * (see update_sound in soundMixerInline.s)
  */
 #if UART_RX_BUFFER == 1
 
 	u8 uart_rx_buf_start;
 	u8 uart_rx_buf_end;
 	u8 uart_rx_buf[UART_RX_BUFFER_SIZE];
+	u8 uart_rx_overflows;
+	u8 uart_rx_bad_packets;
 
 	void UartGoBack(unsigned char count){
 		uart_rx_buf_start-=count;
@@ -738,7 +1295,7 @@ char EepromReadBlock(unsigned int blockId,struct EepromBlockStruct *block){
 	}
 
 	unsigned char UartUnreadCount(){
-		return (abs(uart_rx_buf_end-uart_rx_buf_start));
+		return (u8)(uart_rx_buf_end-uart_rx_buf_start)&(UART_RX_BUFFER_SIZE-1);
 	}
 
 	unsigned char UartReadChar(){
@@ -757,6 +1314,127 @@ char EepromReadBlock(unsigned int blockId,struct EepromBlockStruct *block){
 		uart_rx_buf_end=0;
 	}
 
+	//unread byte at offset from the start, without reading it
+	static u8 uartPeek(u8 offset){
+		return uart_rx_buf[(u8)(uart_rx_buf_start+offset)&(UART_RX_BUFFER_SIZE-1)];
+	}
+
+	/*
+	 * Reads the next framed packet sent with UartSendPacket()
+	 * into data. Returns the payload length, or 0 while no 
+	 * complete packet is buffered. Bytes before a sync byte,
+	 * packets longer than max and packets with a bad CRC
+	 * are dropped and counted in GetUartStats().
+	 */
+	u8 UartReadPacket(u8 *data,u8 max){
+		u8 len,i;
+		u16 crc;
+
+		while(1){
+			while(UartUnreadCount()!=0 && uartPeek(0)!=UART_PACKET_SYNC){
+				UartReadChar();
+			}
+			if(UartUnreadCount()<2) return 0;
+
+			len=uartPeek(1);
+			if(len!=0 && len<=max && len<=UART_RX_BUFFER_SIZE-1-UART_PACKET_OVERHEAD){
+				if(UartUnreadCount()<len+UART_PACKET_OVERHEAD) return 0;
+
+				crc=_crc_ccitt_update(0xffff,len);
+				for(i=0;i<len;i++){
+					data[i]=uartPeek(i+2);
+					crc=_crc_ccitt_update(crc,data[i]);
+				}
+				if(uartPeek(len+2)==(u8)crc && uartPeek(len+3)==(u8)(crc>>8)){
+					UartGoBack(-(len+UART_PACKET_OVERHEAD)); //skip it
+					return len;
+				}
+			}
+
+			//not a packet, look for the next sync byte after this one
+			UartReadChar();
+			uart_rx_bad_packets++;
+		}
+	}
+
+#endif
+
+#if UART_TX_BUFFER == 1
+
+	u8 uart_tx_buf_start;
+	u8 uart_tx_buf_end;
+	u8 uart_tx_buf[UART_TX_BUFFER_SIZE];
+	u8 uart_tx_overflows;
+
+	/*
+	 * Queues a byte for sending, never waits. Returns false
+	 * and counts an overflow if the buffer is full.
+	 */
+	bool UartSendChar(u8 data){
+		u8 next=(uart_tx_buf_end+1)&(UART_TX_BUFFER_SIZE-1);
+		if(next==uart_tx_buf_start){
+			uart_tx_overflows++;
+			return false;
+		}
+		uart_tx_buf[uart_tx_buf_end]=data;
+		uart_tx_buf_end=next; //the mixer only sends it from here
+		return true;
+	}
+
+	//free room in the transmit buffer
+	u8 UartTxFreeCount(){
+		return (u8)(uart_tx_buf_start-uart_tx_buf_end-1)&(UART_TX_BUFFER_SIZE-1);
+	}
+
+	void UartInitTxBuffer(){
+		uart_tx_buf_start=0;
+		uart_tx_buf_end=0;
+	}
+
+	/*
+	 * Queues a framed packet of 1 to UART_TX_BUFFER_SIZE-1-UART_PACKET_OVERHEAD
+	 * bytes, see UART_PACKET_SYNC. The packet is queued whole or not at all:
+	 * returns false and counts an overflow if it does not fit.
+	 */
+	bool UartSendPacket(const u8 *data,u8 len){
+		u16 crc;
+		u8 i;
+
+		if(len==0 || UartTxFreeCount()<len+UART_PACKET_OVERHEAD){
+			uart_tx_overflows++;
+			return false;
+		}
+		UartSendChar(UART_PACKET_SYNC);
+		UartSendChar(len);
+		crc=_crc_ccitt_update(0xffff,len);
+		for(i=0;i<len;i++){
+			UartSendChar(data[i]);
+			crc=_crc_ccitt_update(crc,data[i]);
+		}
+		UartSendChar(crc&0xff);
+		UartSendChar(crc>>8);
+		return true;
+	}
+
+#endif
+
+#if UART_RX_BUFFER == 1 || UART_TX_BUFFER == 1
+
+	void GetUartStats(struct UartStats *stats){
+		#if UART_RX_BUFFER == 1
+			stats->rxOverflows=uart_rx_overflows;
+			stats->badPackets=uart_rx_bad_packets;
+		#else
+			stats->rxOverflows=0;
+			stats->badPackets=0;
+		#endif
+		#if UART_TX_BUFFER == 1
+			stats->txOverflows=uart_tx_overflows;
+		#else
+			stats->txOverflows=0;
+		#endif
+	}
+
 #endif
 
 
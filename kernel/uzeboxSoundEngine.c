@@ -51,6 +51,14 @@ extern u16 steptable[];
 
 struct TrackStruct tracks[CHANNELS];
 
+#if SOUND_ENGINE_PROFILE == 1
+	extern unsigned char sync_phase;
+	extern unsigned char sync_pulse;
+
+	u16 music_cycles;		//cycles used by the last ProcessMusic() call
+	u16 music_cycles_max;	//worst case since startup
+#endif
+
 //player vars
 bool playSong=false;
 
@@ -64,6 +72,11 @@ const char *songStart;
 const char *loopStart;
 unsigned char masterVolume;
 
+#if SONG_STREAMING == 1
+	u32  songStreamLoop;		//stream offset of the loop start delta
+	bool songStreamDelta;		//a delta must be read before the next event
+#endif
+
 
 
 /*
@@ -212,16 +225,47 @@ void StartSong(const char *midiSong){
 		tracks[t].flags&=(~TRACK_FLAGS_PRIORITY);// priority=0;	
 	}
 
+#if SONG_COMPILED == 1
+	//compiled songs start with the delay before the first event
+	songStart=midiSong;
+	nextDeltaTime=pgm_read_byte(midiSong);
+	songPos=midiSong+1;
+	loopStart=midiSong;
+#else
 	songPos=midiSong+1; //skip first delta-time
 	songStart=midiSong+1;//skip first delta-time
 	loopStart=midiSong+1;
 	nextDeltaTime=0;
+#endif
 	currDeltaTime=0;
 	lastStatus=0;
 	songSpeed=0;
 	playSong=true;
 }
 
+#if SONG_STREAMING == 1
+/*
+ * Plays a compiled song stored in consecutive sectors of the SD card.
+ * The card must have been set up with mmc_masterInit(). The first
+ * events arrive a few frames later, once the first sector is read.
+ */
+void StartSongStream(u32 firstSector){
+	playSong=false;
+	for(unsigned char t=0;t<CHANNELS;t++){
+		tracks[t].flags&=(~TRACK_FLAGS_PRIORITY);// priority=0;	
+	}
+
+	if(!SongStreamOpen(firstSector)) return;
+
+	songStreamLoop=0;
+	songStreamDelta=true;
+	nextDeltaTime=0;
+	currDeltaTime=0;
+	songSpeed=0;
+	playSong=true;
+}
+#endif
+
 void RestartSong(){	
 	StartSong(songStart);
 }
@@ -265,12 +309,50 @@ u8 GetSongSpeed(){
 #endif
 
 
+#if SOUND_ENGINE_PROFILE == 1
+/*
+ * Returns the number of cycles elapsed since the start of VSYNC,
+ * from the sync pulse counter and TIMER1. Pulses are half a line
+ * long during the equalization phase.
+ */
+static u32 MusicClock(void){
+	u8 pulse,phase;
+	u16 t;
+
+	//a sync pulse may occur between the reads, retry if it did
+	do{
+		pulse=sync_pulse;
+		phase=sync_phase;
+		t=TCNT1;
+	}while(pulse!=sync_pulse);
+
+	if(phase==0){
+		return ((u32)(SYNC_PRE_EQ_PULSES+SYNC_EQ_PULSES+SYNC_POST_EQ_PULSES-pulse)*(HDRIVE_CL_TWICE+1))+t;
+	}else{
+		return ((u32)(SYNC_PRE_EQ_PULSES+SYNC_EQ_PULSES+SYNC_POST_EQ_PULSES)*(HDRIVE_CL_TWICE+1))
+				+((u32)(SYNC_HSYNC_PULSES-pulse)*(HDRIVE_CL+1))+t;
+	}
+}
+
+/*
+ * Returns the cycles used by ProcessMusic() during the last
+ * frame, or the worst case since startup if 'worst' is true.
+ */
+u16 GetMusicCycles(bool worst){
+	return worst?music_cycles_max:music_cycles;
+}
+#endif
+
 void ProcessMusic(void){
 	u8 c1,c2,channel,tmp,trackVol;
 	s16 vol;
 	u16 uVol,tVol;
 	struct TrackStruct* track;
 
+	#if SOUND_ENGINE_PROFILE == 1
+		u32 start=MusicClock();
+	#endif
+
 
 	//process patches envelopes & pitch slides
 	for(unsigned char trackNo=0;trackNo<CHANNELS;trackNo++){
@@ -303,6 +385,111 @@ void ProcessMusic(void){
 
 
 
+#if SONG_COMPILED == 1
+	#if SONG_STREAMING == 1
+		#define SONG_READ() SongStreamRead()
+	#else
+		#define SONG_READ() pgm_read_byte(songPos++)
+	#endif
+
+	//Process compiled song events
+	//nextDeltaTime counts down the frames before the next event,
+	//currDeltaTime counts the frames the song runs late
+	if(playSong){
+		tmp=SONG_EVENTS_PER_FRAME;
+
+		while(nextDeltaTime==0){
+			//over budget, the rest waits for the next frame
+			if(tmp==0){
+				currDeltaTime++;
+				break;
+			}
+
+		#if SONG_STREAMING == 1
+			//not buffered yet, the song runs late until the stream catches up
+			if(!SongStreamAvailable(songStreamDelta ? 1 : SONG_EVENT_SIZE)){
+				currDeltaTime++;
+				break;
+			}
+			if(songStreamDelta){
+				//the time lost so far is caught up on the next event
+				songStreamDelta=false;
+				nextDeltaTime=SongStreamRead();
+				continue;
+			}
+		#endif
+			tmp--;
+
+			c1=SONG_READ();
+			c2=SONG_READ();
+			trackVol=SONG_READ(); //param2
+			channel=c1&0x0f;
+		#if CHANNELS < 5
+			//songc writes 5 channels, drop the ones the mixer lacks
+			if(c1<SONG_EV_LOOP_START && channel>=CHANNELS) c1=SONG_EV_WAIT;
+		#endif
+
+			switch(c1&0xf0){
+				case SONG_EV_NOTE:
+					TriggerNote(channel,tracks[channel].patchNo,c2,trackVol);
+					break;
+				case SONG_EV_VOLUME:
+					tracks[channel].trackVol=c2;
+					break;
+				case SONG_EV_EXPRESSION:
+					tracks[channel].expressionVol=c2;
+					break;
+				case SONG_EV_TREMOLO_LEVEL:
+					tracks[channel].tremoloLevel=c2;
+					break;
+				case SONG_EV_TREMOLO_RATE:
+					tracks[channel].tremoloRate=c2;
+					break;
+				case SONG_EV_PATCH:
+					tracks[channel].patchNo=c2;
+					break;
+			#if SONG_STREAMING == 1
+				case SONG_EV_LOOP_START:
+					songStreamLoop=SongStreamTell(); //points to the delta of this event
+					break;
+				case SONG_EV_LOOP_END:
+					//the delta is read once the seek is buffered
+					SongStreamSeek(songStreamLoop);
+					songStreamDelta=true;
+					continue;
+				case SONG_EV_END:
+					SongStreamClose();
+					playSong=false;
+					break;
+			#else
+				case SONG_EV_LOOP_START:
+					loopStart=songPos; //points to the delta of this event
+					break;
+				case SONG_EV_LOOP_END:
+					songPos=loopStart;
+					break;
+				case SONG_EV_END:
+					playSong=false;
+					break;
+			#endif
+			}
+
+			if(!playSong) break;
+			nextDeltaTime=SONG_READ();
+
+			//catch up on delayed events
+			if(currDeltaTime>=nextDeltaTime){
+				currDeltaTime-=nextDeltaTime;
+				nextDeltaTime=0;
+			}else{
+				nextDeltaTime-=currDeltaTime;
+				currDeltaTime=0;
+			}
+		}
+
+		if(nextDeltaTime!=0) nextDeltaTime--;
+	}
+#else
 	//Process song MIDI notes
 	if(playSong){
 	
@@ -404,6 +591,7 @@ void ProcessMusic(void){
 		currDeltaTime++;
 	
 	}//end if(playSong)
+#endif
 
 
 
@@ -621,7 +809,12 @@ void ProcessMusic(void){
 		
 		mixer.channels.all[trackNo].volume=(uVol&0xff);
 	}
-	
+
+	#if SOUND_ENGINE_PROFILE == 1
+		start=MusicClock()-start;
+		music_cycles=(start>0xffff)?0xffff:start;
+		if(music_cycles>music_cycles_max) music_cycles_max=music_cycles;
+	#endif
 }
 
 
@@ -770,7 +963,48 @@ void TriggerFx(unsigned char patch,unsigned char volume,bool retrig){
 	}				
 
 	tracks[channel].flags|=TRACK_FLAGS_PRIORITY; //priority=1;	
+	tracks[channel].fxPriority=0;
+	TriggerCommon(channel,patch,volume,80);
+}
+
+/* Trigger a sound effect with a priority level.
+ * Wave fx use voice 1 or 2: a voice without fx is used first, then the
+ * voice with the lowest priority fx, the oldest one on ties.
+ * Noise and PCM fx only have their own channel to play on.
+ * The fx is dropped if all its voices play higher priority fx.
+ *
+ * Returns: the channel used or 0xff if the fx was dropped
+ */
+u8 TriggerFxPriority(u8 patch,u8 volume,u8 priority){
+	u8 channel;
+	struct TrackStruct *t1=&tracks[1],*t2=&tracks[2];
+
+	unsigned char type=(unsigned char)pgm_read_byte(&(patchPointers[patch].type));
+
+	if(type==1 || (type==2 && MIXER_CHAN4_TYPE == 1)){
+		//noise or PCM channel fx
+		channel=3;
+	}else if(type==2){
+		channel=4;
+	}else if((t1->flags&TRACK_FLAGS_PRIORITY)==0){
+		channel=1;
+	}else if((t2->flags&TRACK_FLAGS_PRIORITY)==0){
+		channel=2;
+	}else if(t1->fxPriority!=t2->fxPriority){
+		channel=(t1->fxPriority<t2->fxPriority)?1:2;
+	}else{
+		channel=(t1->patchPlayingTime>t2->patchPlayingTime)?1:2;
+	}
+
+	//never cut a more important fx
+	if((tracks[channel].flags&TRACK_FLAGS_PRIORITY) && tracks[channel].fxPriority>priority){
+		return 0xff;
+	}
+
+	tracks[channel].flags|=TRACK_FLAGS_PRIORITY;
+	tracks[channel].fxPriority=priority;
 	TriggerCommon(channel,patch,volume,80);
+	return channel;
 }
 
 
@@ -309,6 +309,11 @@ void FadeOut(unsigned char speed,bool blocking){
 	doFade(speed,blocking);
 }
 
+//true until a non-blocking FadeIn/FadeOut has written its last step
+bool IsFadeActive(void){
+	return fadeActive;
+}
+
 
 //called by the kernel at each field end
 void ProcessFading(){
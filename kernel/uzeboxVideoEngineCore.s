@@ -437,6 +437,16 @@ no_render:
 	call process_music
 	clr r1
 
+	;read the streamed song from the SD card
+	#if SONG_STREAMING == 1
+		call ProcessSongStream
+	#endif
+
+	;write the next queued EEPROM byte
+	#if EEPROM_WRITE_QUEUE == 1
+		call ProcessEepromQueue
+	#endif
+
 	;process user post callback
 	lds ZL,post_vsync_user_callback+0
 	lds ZH,post_vsync_user_callback+1
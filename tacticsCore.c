@@ -6,6 +6,9 @@
 #include <avr/interrupt.h>
 //#include <uzebox.h>
 #include "kernel/uzebox.h"
+#include "kernel/mmc_player.h"
+#include "kernel/petitfatfs/pff.h"
+#include "kernel/petitfatfs/diskio.h"
 
 
 /* data includes */
@@ -13,6 +16,8 @@
 #include "res/tiles.inc"
 #include "res/fontmap.inc"
 #include "res/sprites.inc"
+#include "res/rules.inc"
+#include "res/patches.inc"
 
 /* structs */
 struct GridBufferSquare {
@@ -28,10 +33,24 @@ struct Unit {
     unsigned char xPos;
     unsigned char yPos;
 };
+struct Property {
+	unsigned char x;
+	unsigned char y;
+};
 struct Movement {
 	char direction;
 	char movePoints;
 };
+struct PeriodicTask {
+	void (*run)(void);
+	unsigned char period; // frames between runs
+	unsigned char counter;
+	unsigned char enabled;
+	unsigned int stateMask; // bit per controlState the task may run in
+	unsigned char lastLines; // scanlines spent in the last run
+	unsigned char maxLines;
+	u32 totalLines; // 16 bits would wrap within seconds for a per-frame task
+};
 
 /* defines */
 #ifndef OFF_SCREEN 
@@ -40,13 +59,17 @@ struct Movement {
 
 #define LEVEL_HEIGHT 11
 #define MAX_UNITS 40
+#define MAX_TEAM_UNITS 20
 #define MAX_PROPERTIES 20
 #define MAX_LEVEL_WIDTH 30
 #define MAX_VIS_WIDTH 14
+#define BITMAP_SIZE ((MAX_LEVEL_WIDTH*LEVEL_HEIGHT+7)/8)
+#define COSTMAP_SIZE ((MAX_LEVEL_WIDTH*LEVEL_HEIGHT+1)/2)
 #define TRUE 1
 #define FALSE 0
 
 #define EEPROM_INDEX 833
+#define EEPROM_SLOTS 4
 
 #define BLINK_UNITS 0
 #define BLINK_TERRAIN 1
@@ -62,6 +85,8 @@ struct Movement {
 
 // convert our player value to controller value
 #define JPPLAY(pl) ((pl) == PL2 ? 1 : 0)
+// convert our player value to an index for per-player arrays
+#define PLINDEX(pl) ((pl) == PL1 ? 0 : 1)
 
 // level data masks
 #define TERRAIN_MASK 0b00000111
@@ -86,6 +111,14 @@ struct Movement {
 
 #define MAX_UNIT_MP 10
 
+// periodic tasks
+#define MAX_TASKS 4
+#define STATE_BIT(s) (1<<(s))
+#define ALL_STATES 0xFFFF
+
+// the screen fades out and in between turns, the kernel fader holds each of its 12 steps for speed+1 frames
+#define TURN_FADE_SPEED 3
+
 // terrain types
 #define PL	0x01 // plain
 #define MO	0x02 // mountain
@@ -116,6 +149,21 @@ struct Movement {
 #define GETPLAY(x) ((x)&OWNER_MASK)
 #define INDEXPLAY(x) (((x) >> 6))
 
+// per-square maps, laid out like levelBuffer
+#define CELLINDEX(x, y) ((unsigned int)(x)*LEVEL_HEIGHT+(y))
+// one bit per square
+#define GETCELLBIT(m, x, y) ((m)[CELLINDEX(x, y)>>3]&(1<<(CELLINDEX(x, y)&7)))
+#define SETCELLBIT(m, x, y) (m)[CELLINDEX(x, y)>>3] |= (1<<(CELLINDEX(x, y)&7))
+#define CLRCELLBIT(m, x, y) (m)[CELLINDEX(x, y)>>3] &= ~(1<<(CELLINDEX(x, y)&7))
+// one nibble per square, for movement point searches
+#define GETCOST(x, y) ((costMap[CELLINDEX(x, y)>>1] >> ((CELLINDEX(x, y)&1)<<2))&0x0F)
+#define SETCOST(x, y, v) costMap[CELLINDEX(x, y)>>1] = (costMap[CELLINDEX(x, y)>>1]&(0xF0 >> ((CELLINDEX(x, y)&1)<<2)))|((v) << ((CELLINDEX(x, y)&1)<<2))
+
+// fog of war; p is a player index
+#define ISVISIBLE(p, x, y) GETCELLBIT(visibility[p], x, y)
+#define SETVISIBLE(p, x, y) SETCELLBIT(visibility[p], x, y)
+#define CLRVISIBLE(p, x, y) CLRCELLBIT(visibility[p], x, y)
+
 // map load directions
 #define LOAD_ALL	0x01
 #define LOAD_LEFT   0x04
@@ -157,6 +205,36 @@ struct Movement {
 
 #define SPRITE_POS_EXPL1 4
 #define SPRITE_POS_EXPL2 5
+
+//sound effects, index into patches
+#define SFX_CURSOR 0
+#define SFX_STEP 1
+#define SFX_EXPLOSION 2
+#define SFX_CAPTURE 3
+#define SFX_VOLUME 0xB0
+
+// binary telemetry over the UART, decoded by tools/tlmdump.c
+#ifndef TELEMETRY
+#define TELEMETRY UART_TX_BUFFER
+#endif
+// record types, the first payload byte of each packet
+#define TLM_FRAME 0x01 // frame lo, frame hi, state, game lines, task lines, ram tiles, stack free lo/hi, music cycles lo/hi, tx overflows
+#define TLM_MOVE 0x02 // frame lo, frame hi, unit, info, x, y
+#define TLM_ATTACK 0x03 // frame lo, frame hi, attacker, defender, damage, defender hp
+#define TLM_TURN 0x04 // frame lo, frame hi, new player, credits, units, 0
+#define TLM_PRODUCE 0x05 // frame lo, frame hi, unit, info, x, y
+#define TLM_GAME_OVER 0x06 // frame lo, frame hi, winner, loser units, loser bases, 0
+#define TLM_OVERRUN 0xFF // game lines of a frame that missed its vsync
+
+// levels read from ASSETS.PAK on the SD card, built by tools/packgen.c
+#ifndef ASSET_PACK
+#define ASSET_PACK 1
+#endif
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 8 // "UTPK", version, 0, entry count lo/hi
+#define PACK_ENTRY_SIZE 8 // key lo/hi, size lo/hi, offset lo..hi; sorted by key
+#define PACK_LEVEL 0x01 // asset types, the high byte of the key
+#define PACK_KEY(type, n) ((unsigned int)(type) << 8 | (n))
 //#define SPRITE_MOVINGUNIT 5
 
 
@@ -169,36 +247,70 @@ unsigned char vramX; // where cameraX points to in vram coords, wrapped on 0x1F
 unsigned char selectionVar = 0; // generic selection variable
 
 struct EepromBlockStruct eepromData;
+struct EepromJournal eepromJournal;
+
+// gameplay rolls and cosmetic effects draw from separate streams,
+// so changing an animation never changes the outcome of a fight
+struct Rng gameRng;
+struct Rng fxRng;
 
-char blinkCounter = 0;
 char blinkState = BLINK_UNITS;
 char blinkMode = FALSE;
 
-char cursorCounter = 0; //for cursor alternation
-char cursorAlt = FALSE;
+char cursorAlt = FALSE; //for cursor alternation
+
+struct PeriodicTask taskList[MAX_TASKS];
+unsigned char taskCount = 0;
+unsigned char blinkTask = 0xFF;
+
+extern unsigned char sync_pulse; // kernel scanline counter, counts down every hsync
+extern unsigned char free_tile_index; // kernel, ram tiles used by the sprites
+
+#if TELEMETRY == 1
+unsigned int tlmFrame = 0; // frames since startup
+unsigned char tlmFrameStart = 0; // sync_pulse when the game got the frame
+#endif
 
-int curInput;
-int prevInput;
 unsigned char activePlayer;
 
 unsigned char credits[] = {0, 0};
 
+struct Property properties[2][MAX_PROPERTIES]; // cities and bases each player owns, unordered
+unsigned char propertyCount[] = {0, 0};
+unsigned char baseCount[] = {0, 0}; // a player who loses the last one loses the game
+
 const char* currentLevel;
 
+#if ASSET_PACK == 1
+FATFS packFs;
+unsigned int packCount = 0; // assets in the pack, 0 when there is none
+#endif
+
 enum
 {
-	scrolling, unit_menu, unit_movement, unit_moving, unit_attack, end_turn, pause, menu
+	scrolling, unit_menu, unit_movement, unit_moving, unit_attack, end_turn, pause, menu, production, game_over
 }	controlState;
 
 // what is visible on the screen; 14 wide, 11 high, 2 loading columns on each side
 struct GridBufferSquare levelBuffer[MAX_LEVEL_WIDTH][LEVEL_HEIGHT];
 
-unsigned char unitFirstEmpty = 0;
-unsigned char unitListEnd = 0;
+unsigned char unitFirstEmpty = 0; // head of the free slot list
+unsigned char unitNext[MAX_UNITS]; // links of the free list and of each player's units, 0xFF ends a list
+unsigned char unitFirstOwned[] = {0xFF, 0xFF}; // head of each player's unit list
+unsigned char unitCount[] = {0, 0}; // live units per player
 signed char lastJumpedUnit = -1;
 
 struct Unit unitList[MAX_UNITS]; //is this enough?
 
+unsigned char visibility[2][BITMAP_SIZE]; // what each player's units can see
+
+unsigned char costMap[COSTMAP_SIZE]; // scratch, remaining movement points+1 per square
+unsigned char moveMapUnit = 0xFF; // unit whose moves costMap holds, 0xFF for none
+unsigned char threatMap[BITMAP_SIZE]; // squares the enemy can attack next turn
+char threatMode = FALSE;
+char threatValid = FALSE; // cleared whenever units move, die or the turn ends
+char quickMove = FALSE; // in unit_movement the cursor picks the square, the route follows
+
 struct Movement movementBuffer[10]; // ought to be enough
 uint8_t movementCount = 0;
 uint8_t  movementPoints = 0;
@@ -212,19 +324,41 @@ unsigned char attackedUnit = 0;
 // param1, param2, param3; return
 void initialize();
 void loadLevel(const char*); // level
+void startLevel(unsigned char, unsigned char); // width, height
+void placeLevelCell(unsigned char, unsigned char, char); // x, y, cell
+void setPropertyOwner(unsigned char, unsigned char, char); // x, y, player
+#if ASSET_PACK == 1
+char openPack(); // opened
+unsigned int findPackAsset(unsigned int, u32*); // key, offset; size
+char loadPackLevel(unsigned char); // level number; loaded
+#endif
 void drawLevel(char); // direction
 void drawHPBar(unsigned char, unsigned char, char); // x, y, value
 void drawDefenseBar(unsigned char, unsigned char, char); //same as hp bar
 void drawOverlay();
 void drawArrow();
+void initUnitPool();
 unsigned char addUnit(unsigned char, unsigned char, char, char); // x, y, player, type; unitIndex
 void removeUnitByIndex(unsigned char); // index
 void removeUnit(unsigned char, unsigned char); // x, y
 void moveUnit();
+void revealSight(unsigned char); // index
+void hideSight(unsigned char); // index
+char isUnitVisible(unsigned char, unsigned char); // x, y; visible
+void computeThreatMap();
+void spreadMovePoints(char); // unit type
+void computeMoveMap(unsigned char); // index
+char routeTo(unsigned char, unsigned char); // x, y; found
+char quickSelect(char); // direction; found
+void eraseArrow();
+void markAttackArea(unsigned char, unsigned char, char); // x, y, range
+void setThreatMode(char); // on-off
 char moveCamera(char); // direction
 char moveCameraInstant(char); // x
 char moveCursor(char); // direction
 char moveCursorInstant(unsigned char, unsigned char); // x, y
+char moveCursorInView(unsigned char, unsigned char); // x, y
+unsigned char getCenteredCameraX(unsigned char); // x; cameraX
 char validArrowTile(unsigned char, unsigned char); // x, y, hasArrow
 const char* getTileMap(unsigned char, unsigned char); // x, y; tileMap
 void waitGameInput();
@@ -236,14 +370,30 @@ void setBlinkMode(char); // on-off
 const char* getUnitName(unsigned char); // unit; unitName
 char getNeededMovePoints(const char unit, const char terrain);
 char getAttackRange(const char unit);
+char getSightRange(const char unit);
+unsigned char getUnitCost(const char unit);
+void playSfx(unsigned char); // sfx
 char getDamage(struct Unit* srcUnit, struct Unit* dstUnit);
-char getRandomNumber(); // ; rand
-char getRandomNumberLimit(char); // max; rand
+void getDamageRange(struct Unit* srcUnit, struct Unit* dstUnit, unsigned char* min, unsigned char* max);
 unsigned char getNextAttackableUnitIndex(signed char last, char dir);
 void saveEeprom();
 
+unsigned char addTask(void (*)(void), unsigned char, unsigned int); // callback, period, state mask; taskIndex
+void setTaskEnabled(unsigned char, char); // taskIndex, on-off
+void runTasks();
+unsigned char getElapsedLines(unsigned char); // start sync_pulse; lines
+void taskCursorAlternate();
+void taskArrow();
+void taskBlink();
 void WaitVsync_(char);
 
+#if TELEMETRY == 1
+void tlmSendFrame(unsigned char, unsigned char); // game lines, task lines
+void tlmSendEvent(unsigned char, unsigned char, unsigned char, unsigned char, unsigned char); // type, a, b, c, d
+#else
+#define tlmSendEvent(type, a, b, c, d)
+#endif
+
 
 /*const char testlevel[] PROGMEM =
 {
@@ -291,7 +441,16 @@ const char shortlevel[] PROGMEM =
 /* main function */
 int main() {
 	initialize();
-	loadLevel(testlevel);
+	// before the first draw, the fog shown is the active player's
+	activePlayer = PL1;
+	credits[0] = 10;
+	credits[1] = 10;
+
+	// the built-in level is played when there is no card or pack
+#if ASSET_PACK == 1
+	if(!loadPackLevel(0))
+#endif
+		loadLevel(testlevel);
 	FadeOut(0, true);
 	drawLevel(LOAD_ALL);
 	drawOverlay();
@@ -299,10 +458,6 @@ int main() {
 	MoveSprite(0,0,0,2,2);
 	FadeIn(5, true);
 
-	activePlayer = PL1;
-	credits[0] = 10;
-	credits[1] = 10;
-
 	waitGameInput();
 
 	return 0;
@@ -310,40 +465,69 @@ int main() {
 
 
 void initialize() {
+#if SONG_STREAMING == 1
+	mmc_File song;
+#endif
+
 	Screen.scrollHeight = 28;
 	Screen.overlayHeight = 4;
 	Screen.overlayTileTable = terrainTiles; // seems like it has to share the tiles, otherwise we can't use the fonts
+#if ASSET_PACK == 1
+	// before the song stream, mounting resets the card
+	openPack();
+#endif
+#if SONG_STREAMING == 1
+	// the music is streamed from the first .SNG file on the card,
+	// vram holds the directory sector until it gets cleared below
+	if(mmc_masterInit(vram) == 0 && mmc_listDir(&song, 1, "SNG") == 1)
+		StartSongStream(song.firstSector);
+#endif
 	ClearVram();
 	SetFontTilesIndex(TERRAINTILES_SIZE);
 	SetTileTable(terrainTiles);
 	SetSpritesTileTable(spriteTiles);
+	InitMusicPlayer(patches);
+
+	addTask(taskCursorAlternate, 40, ALL_STATES);
+	addTask(taskArrow, 1, STATE_BIT(unit_movement));
+	blinkTask = addTask(taskBlink, 30, ALL_STATES & ~(STATE_BIT(end_turn)|STATE_BIT(production)|STATE_BIT(game_over)));
+	setTaskEnabled(blinkTask, FALSE);
+
+	// held directions repeat once per cursor step (moveCursor takes 16 frames)
+	SetInputRepeat(16, 16, BTN_UP|BTN_DOWN|BTN_LEFT|BTN_RIGHT);
 
 	eepromData.id = EEPROM_INDEX;
-	if(!isEepromFormatted() || EepromReadBlock(EEPROM_INDEX, &eepromData)) {
+	if(EepromJournalOpen(&eepromJournal, EEPROM_INDEX, EEPROM_SLOTS, eepromData.data)) {
 		// no idea what to do here...
 	}
+
+	// the gameplay stream goes on from the last save, the cosmetic one is
+	// billions of steps further along the same sequence. Not 2^31: half a
+	// period away the outputs only differ in their top bit.
+	RngSeed(&gameRng, eepromData.data[0] | (unsigned int)eepromData.data[1] << 8 |
+			(u32)eepromData.data[2] << 16 | (u32)eepromData.data[3] << 24);
+	fxRng = gameRng;
+	RngJump(&fxRng, 0x9E3779B9UL);
 }
 
-void jumpToNextUnit() {
+// the next of the player's units that can still act, 0xFF when there is none
+unsigned char findNextUnit() {
 	for(unsigned char i = lastJumpedUnit+1; i != lastJumpedUnit; i = (i+1)%MAX_UNITS) {
 		//TODO: make this only jump to not moved or attacked units
 		//should this be !(hasmoved || hasattacked)?
 		if(unitList[i].isUnit && GETPLAY(unitList[i].info) == activePlayer && !(HASMOVED(unitList[i].other) && HASATTACKED(unitList[i].other))) {
-			if((unitList[i].xPos < cameraX) || (unitList[i].xPos > (cameraX + MAX_VIS_WIDTH))) {
-				signed char tempX = unitList[i].xPos - MAX_VIS_WIDTH/2;
-				if(tempX < 0) {
-					tempX = 0;
-				}
-				else if(tempX > (levelWidth - MAX_VIS_WIDTH)) {
-					tempX = levelWidth - MAX_VIS_WIDTH;
-				}
-				moveCameraInstant(unitList[i].xPos - MAX_VIS_WIDTH/2);
-			}
-			moveCursorInstant(unitList[i].xPos, unitList[i].yPos);
 			lastJumpedUnit = i;
-			break;
+			return i;
 		}
 	}
+	return 0xFF;
+}
+
+void jumpToNextUnit() {
+	unsigned char i = findNextUnit();
+	// the camera only moves when the unit is off screen, changeTurn centres it
+	if(i != 0xFF)
+		moveCursorInView(unitList[i].xPos, unitList[i].yPos);
 }
 void drawTwoSelMenu(const char* prompt, const char* sel1, const char* sel2) {
 
@@ -366,6 +550,52 @@ void drawTwoSelMenu(const char* prompt, const char* sel1, const char* sel2) {
 
 }
 
+void drawProductionMenu() {
+	unsigned char i, x;
+	x = vramX+5;
+
+	Fill(x&0x1F, 5, 16, 8, INTERFACE_MID);
+	SetTile(x&0x1F, 5, INTERFACE_TL);
+	Fill(x&0x1F, 6, 1, 6, INTERFACE_LEFT);
+	SetTile(x&0x1F, 12, INTERFACE_BL);
+	Fill((x+1)&0x1F, 12, 14, 1, INTERFACE_BOT);
+	SetTile((x+15)&0x1F, 12, INTERFACE_BR);
+	Fill((x+15)&0x1F, 6, 1, 6, INTERFACE_RIGHT);
+	SetTile((x+15)&0x1F, 5, INTERFACE_TR);
+	Fill((x+1)&0x1F, 5, 14, 1, INTERFACE_TOP);
+
+	Print((x+1)&0x1F, 6, PSTR("Build unit"));
+
+	for(i = 0; i < 5; i++) {
+		Print((x+3)&0x1F, 7+i, getUnitName((i+1)<<3));
+		PrintByte((x+14)&0x1F, 7+i, getUnitCost((i+1)<<3), FALSE);
+	}
+
+	SetTile((x+2)&0x1F, 7+selectionVar, INTERFACE_ARROW);
+}
+
+// builds the selected unit on the base under the cursor
+char produceUnit() {
+	unsigned char type = (selectionVar+1)<<3;
+	unsigned char cost = getUnitCost(type);
+	unsigned char unit;
+
+	if(credits[PLINDEX(activePlayer)] < cost)
+		return FALSE;
+
+	unit = addUnit(cursorX, cursorY, activePlayer, type);
+	if(unit == 0xFF)
+		return FALSE;
+
+	credits[PLINDEX(activePlayer)] -= cost;
+	SETHASPROD(cursorX, cursorY, TRUE);
+	tlmSendEvent(TLM_PRODUCE, unit, unitList[unit].info, cursorX, cursorY);
+	// fresh units wait until next turn
+	SETHASMOVED(unit, TRUE);
+	SETHASATTACKED(unit, TRUE);
+	return TRUE;
+}
+
 void attackUnit() {
 	MoveSprite(0, OFF_SCREEN, 0, 2, 2);
 //	PrintHexByte(11, OVR2, sprites[SPRITE_POS_EXPL1].y);
@@ -380,20 +610,23 @@ void attackUnit() {
 	sprites[SPRITE_POS_EXPL2].y = 0;
 
 	char cycles = 0;
-	char ex1_start = (getRandomNumberLimit(4) + 1) * 3; // random half-cycle between 1 and 5
-	char ex2_start = ex1_start + (getRandomNumberLimit(7) + 3) * 3;
+	char ex1_start = (RngRange(&fxRng, 5) + 1) * 3; // random half-cycle between 1 and 5
+	char ex2_start = ex1_start + (RngRange(&fxRng, 8) + 3) * 3;
 	char max_cycles = ex2_start + 20 * 3;
 
 	int8_t damage = getDamage(&unitList[attackingUnit], &unitList[attackedUnit]);
+	tlmSendEvent(TLM_ATTACK, attackingUnit, attackedUnit, damage, unitList[attackedUnit].hp);
 
 	while(cycles < max_cycles) {
 		if(cycles == ex1_start) {
-			sprites[SPRITE_POS_EXPL1].x = (cursorX-cameraX)*16 + getRandomNumberLimit(10);
-			sprites[SPRITE_POS_EXPL1].y = cursorY*16 + getRandomNumberLimit(2) + 1;
+			playSfx(SFX_EXPLOSION);
+			sprites[SPRITE_POS_EXPL1].x = (cursorX-cameraX)*16 + RngRange(&fxRng, 11);
+			sprites[SPRITE_POS_EXPL1].y = cursorY*16 + RngRange(&fxRng, 3) + 1;
 		}
 		if(cycles == ex2_start) {
-			sprites[SPRITE_POS_EXPL2].x = (cursorX-cameraX)*16 + getRandomNumberLimit(10) + 1;
-			sprites[SPRITE_POS_EXPL2].y = cursorY*16 + getRandomNumberLimit(3) + 8;
+			playSfx(SFX_EXPLOSION);
+			sprites[SPRITE_POS_EXPL2].x = (cursorX-cameraX)*16 + RngRange(&fxRng, 11) + 1;
+			sprites[SPRITE_POS_EXPL2].y = cursorY*16 + RngRange(&fxRng, 4) + 8;
 		}
 		if(cycles > ex1_start && cycles < ex1_start+60) {
 			sprites[SPRITE_POS_EXPL1].tileIndex = SPRITE_EXPLOSION+(cycles-ex1_start)/6;
@@ -444,331 +677,467 @@ void attackUnit() {
 }
 
 
+// only the new player's units and properties are visited, not the whole map
 void endTurn() {
-	unsigned char i, x, y, terr;
+	unsigned char i, p, x, y, terr;
 	setBlinkMode(FALSE);
-	drawLevel(LOAD_ALL);
 	activePlayer = (activePlayer == PL1) ? PL2 : PL1;
-
-	for(i = 0; i < MAX_UNITS; i++) {
-		if(unitList[i].isUnit && GETPLAY(unitList[i].info) == activePlayer) {
-			// reset markers on units
-			SETHASMOVED(i, FALSE);
-			SETHASATTACKED(i, FALSE);
-
-			x = unitList[i].xPos;
-			y = unitList[i].yPos;
-			terr = GETTERR(levelBuffer[x][y].info);
-
-			// heal units on bases&cities
-			if(GETPLAY(levelBuffer[x][y].info) == activePlayer && (terr == CT || terr == BS)) {
-				unitList[i].hp += 20;
-				if(unitList[i].hp > 100)
-					unitList[i].hp = 100;
-			}
-			// convert bases/cities
-			else if(terr == CT || terr == BS) {
-				levelBuffer[x][y].info = terr|activePlayer;
-			}
+	p = PLINDEX(activePlayer);
+	threatValid = FALSE;
+
+	for(i = unitFirstOwned[p]; i != 0xFF; i = unitNext[i]) {
+		// reset markers on units
+		SETHASMOVED(i, FALSE);
+		SETHASATTACKED(i, FALSE);
+
+		x = unitList[i].xPos;
+		y = unitList[i].yPos;
+		terr = GETTERR(levelBuffer[x][y].info);
+
+		// heal units on bases&cities
+		if(GETPLAY(levelBuffer[x][y].info) == activePlayer && (terr == CT || terr == BS)) {
+			unitList[i].hp += 20;
+			if(unitList[i].hp > 100)
+				unitList[i].hp = 100;
+		}
+		// convert bases/cities
+		else if(terr == CT || terr == BS) {
+			setPropertyOwner(x, y, activePlayer);
+			playSfx(SFX_CAPTURE);
 		}
 	}
 	// money 'n shit
 	// 4 per owned, 4 by default
-	credits[(activePlayer == PL1) ? 0 : 1] += 4;
-	for(x=0; x < levelWidth; x++) {
-		for(y=0; y < levelHeight; y++) {
-			terr = GETTERR(levelBuffer[x][y].info);
-			if(GETPLAY(levelBuffer[x][y].info) == activePlayer && (terr == CT || terr == BS)) {
-				SETHASPROD(x, y, FALSE);
-				credits[activePlayer == PL1 ? 0 : 1] += 4;
-			}
-		}
-	}
+	credits[p] += 4 + 4*propertyCount[p];
+	for(i = 0; i < propertyCount[p]; i++)
+		SETHASPROD(properties[p][i].x, properties[p][i].y, FALSE);
 
 	if(credits[activePlayer == PL1 ? 0 : 1] > 200)
 		credits[(activePlayer == PL1) ? 0 : 1] = 200;
 
+	tlmSendEvent(TLM_TURN, activePlayer, credits[PLINDEX(activePlayer)], unitCount[PLINDEX(activePlayer)], 0);
+
+	saveEeprom();
+}
+
+// hands the game to the next player. the screen is dark while their view
+// is built, so the camera, fog, threat map, cursor and overlay are all
+// done once and the turn comes back in one piece as it fades in.
+void changeTurn() {
+	unsigned char i;
+
+	FadeOut(TURN_FADE_SPEED, false);
+	while(IsFadeActive()) // the tasks keep running until the screen is dark
+		WaitVsync_(1);
+
+	endTurn();
+	controlState = scrolling;
+	i = findNextUnit();
+	if(i != 0xFF) {
+		cursorX = unitList[i].xPos;
+		cursorY = unitList[i].yPos;
+		cameraX = getCenteredCameraX(cursorX);
+	}
+	drawLevel(LOAD_ALL);
+	moveCursorInstant(cursorX, cursorY); // the camera is already there, only the sprite moves
+	drawOverlay();
+
+	FadeIn(TURN_FADE_SPEED, false);
+}
+
+// a player is out with no units or no bases left; NEU while both play on
+unsigned char getLoser() {
+	if(unitCount[0] == 0 || baseCount[0] == 0)
+		return PL1;
+	if(unitCount[1] == 0 || baseCount[1] == 0)
+		return PL2;
+	return NEU;
+}
+
+void drawGameOver(unsigned char winner) {
+	unsigned char x = vramX+5;
+
+	Fill(x&0x1F, 5, 12, 4, INTERFACE_MID);
+	SetTile(x&0x1F, 5, INTERFACE_TL);
+	Fill(x&0x1F, 6, 1, 2, INTERFACE_LEFT);
+	SetTile(x&0x1F, 8, INTERFACE_BL);
+	Fill((x+1)&0x1F, 8, 10, 1, INTERFACE_BOT);
+	SetTile((x+11)&0x1F, 8, INTERFACE_BR);
+	Fill((x+11)&0x1F, 6, 1, 2, INTERFACE_RIGHT);
+	SetTile((x+11)&0x1F, 5, INTERFACE_TR);
+	Fill((x+1)&0x1F, 5, 10, 1, INTERFACE_TOP);
+
+	Print((x+2)&0x1F, 6, winner == PL1 ? PSTR("P1 wins!") : PSTR("P2 wins!"));
+	Print((x+2)&0x1F, 7, PSTR("Start"));
+}
+
+// stops the game, start plays it again
+void gameOver(unsigned char loser) {
+	unsigned char winner = loser == PL1 ? PL2 : PL1;
+
+	setBlinkMode(FALSE);
+	threatMode = FALSE;
+	controlState = game_over;
+	movementCount = 0;
+	drawLevel(LOAD_ALL);
+	drawGameOver(winner);
+	tlmSendEvent(TLM_GAME_OVER, winner, unitCount[PLINDEX(loser)], baseCount[PLINDEX(loser)], 0);
 }
 
 
 void waitGameInput() {
-	curInput = prevInput = ReadJoypad(JPPLAY(activePlayer));
-	//char asd = 0; //unused 
-	//char tmpUnit = 0; //unused
-	while(1) {
-		curInput = ReadJoypad(JPPLAY(activePlayer));
+	struct InputEvent event;
+	unsigned char loser;
 
+	ClearInputEvents();
+	while(1) {
 		drawOverlay();
 
-		switch(controlState) //scrolling, unit_menu, unit_movement, pause, menu
-		{
-			case scrolling:
-				if(curInput&BTN_A && !(prevInput&BTN_A)) {
-					if(levelBuffer[cursorX][cursorY].unit != 0xff && GETPLAY(unitList[levelBuffer[cursorX][cursorY].unit].info) == activePlayer) {
-						// enter select unit mode if there's a unit here and it belongs to us
-						//displayUnitMenu();
-						selectionVar = 0;
-						//setBlinkMode(FALSE);
-						controlState = unit_menu;
+		// the counters are kept by addUnit, removeUnitByIndex and setPropertyOwner
+		if(controlState != game_over && (loser = getLoser()) != NEU)
+			gameOver(loser);
 
-					}
-				}
-				if(curInput&BTN_X && !(prevInput&BTN_X)) {
-					// toggle blink mode
-					setBlinkMode(!blinkMode);
-				}
-				if(curInput&BTN_LEFT) {
-					// move cur left
-					moveCursor(DIR_LEFT);
-				}
-				if(curInput&BTN_RIGHT) {
-					// move cur right
-					moveCursor(DIR_RIGHT);
-				}
-				if(curInput&BTN_UP) {
-					// move cur up
-					moveCursor(DIR_UP);
-				}
-				if(curInput&BTN_DOWN) {
-					// move cur down
-					moveCursor(DIR_DOWN);
-				}
-				if(curInput&BTN_Y && !(prevInput&BTN_Y)) {
-					jumpToNextUnit();
-				}
-				if(curInput&BTN_SELECT && !(prevInput&BTN_SELECT)) {
-					// open end turn menu
-					controlState = end_turn;
-					selectionVar = 0;
+		while(GetInputEvent(&event)) {
+			// only the active player's presses and repeats matter
+			if(event.joypad != JPPLAY(activePlayer) || event.type == INPUT_RELEASE)
+				continue;
 
-					MoveSprite(0, 224, 0, 2, 2);
-					drawTwoSelMenu(PSTR("End turn?"), PSTR("Yes"), PSTR("No"));
-//
-//
-//					DrawMap2((vramX+5)%0x1F, 5, INTERFACE_TR)
+			switch(controlState) //scrolling, unit_menu, unit_movement, pause, menu
+			{
+				case scrolling:
+					switch(event.button) {
+					case BTN_A:
+						if(levelBuffer[cursorX][cursorY].unit != 0xff && GETPLAY(unitList[levelBuffer[cursorX][cursorY].unit].info) == activePlayer) {
+							// enter select unit mode if there's a unit here and it belongs to us
+							//displayUnitMenu();
+							selectionVar = 0;
+							//setBlinkMode(FALSE);
+							controlState = unit_menu;
 
-				}
-				break;
-			case unit_menu:
-				if(curInput&BTN_X && !(prevInput&BTN_X)) {
-					// toggle blink mode
-					setBlinkMode(!blinkMode);
-				}
-				if(curInput&BTN_A && !(prevInput&BTN_A)) {
-					// do selection
-					if(selectionVar == 1) { // move
-						if(!HASMOVED(unitList[levelBuffer[cursorX][cursorY].unit].other)) {
-							controlState = unit_movement;
-							movementPoints = 10;
-							moveCursorInstant(cursorX, cursorY); // just to normalize
-							movingUnit = levelBuffer[cursorX][cursorY].unit;
-							arrowX = unitList[movingUnit].xPos;
-							arrowY = unitList[movingUnit].yPos;
 						}
+						else if(levelBuffer[cursorX][cursorY].unit == 0xff && GETTERR(levelBuffer[cursorX][cursorY].info) == BS &&
+								GETPLAY(levelBuffer[cursorX][cursorY].info) == activePlayer && !HASPROD(levelBuffer[cursorX][cursorY].info)) {
+							// empty base of ours that hasn't built anything this turn
+							controlState = production;
+							selectionVar = 0;
+
+							MoveSprite(0, 224, 0, 2, 2);
+							drawProductionMenu();
+						}
+						break;
+					case BTN_X:
+						// toggle blink mode
+						setBlinkMode(!blinkMode);
+						break;
+					case BTN_SR:
+						// toggle enemy threat overlay
+						setThreatMode(!threatMode);
+						break;
+					case BTN_LEFT:
+					case BTN_RIGHT:
+					case BTN_UP:
+					case BTN_DOWN:
+						// repeats queued up while the cursor was moving are stale once the button is let go
+						if(event.type == INPUT_REPEAT && !(ReadJoypad(event.joypad)&event.button))
+							break;
+						moveCursor(event.button == BTN_LEFT ? DIR_LEFT : event.button == BTN_RIGHT ? DIR_RIGHT :
+								event.button == BTN_UP ? DIR_UP : DIR_DOWN);
+						break;
+					case BTN_Y:
+						jumpToNextUnit();
+						break;
+					case BTN_SELECT:
+						// open end turn menu
+						controlState = end_turn;
+						selectionVar = 0;
+
+						MoveSprite(0, 224, 0, 2, 2);
+						drawTwoSelMenu(PSTR("End turn?"), PSTR("Yes"), PSTR("No"));
+//
+//
+//						DrawMap2((vramX+5)%0x1F, 5, INTERFACE_TR)
+						break;
 					}
-					else if(selectionVar == 0){ // attack
-						if(!HASATTACKED(unitList[levelBuffer[cursorX][cursorY].unit].other)) {
-							attackingUnit = levelBuffer[cursorX][cursorY].unit;
-							attackedUnit = getNextAttackableUnitIndex(-1, 1);
-							if(attackedUnit != 0xFF) {
-								controlState = unit_attack;
-								cursorX = unitList[attackedUnit].xPos;
-								cursorY = unitList[attackedUnit].yPos;
-								moveCursorInstant(cursorX, cursorY);
+					break;
+				case unit_menu:
+					switch(event.button) {
+					case BTN_X:
+						// toggle blink mode
+						setBlinkMode(!blinkMode);
+						break;
+					case BTN_A:
+						// do selection
+						if(selectionVar == 1) { // move
+							if(!HASMOVED(unitList[levelBuffer[cursorX][cursorY].unit].other)) {
+								controlState = unit_movement;
+								movementPoints = 10;
+								moveCursorInstant(cursorX, cursorY); // just to normalize
+								movingUnit = levelBuffer[cursorX][cursorY].unit;
+								arrowX = unitList[movingUnit].xPos;
+								arrowY = unitList[movingUnit].yPos;
+								computeMoveMap(movingUnit);
+								quickMove = FALSE; // each unit starts with the arrow
 							}
 						}
+						else if(selectionVar == 0){ // attack
+							if(!HASATTACKED(unitList[levelBuffer[cursorX][cursorY].unit].other)) {
+								attackingUnit = levelBuffer[cursorX][cursorY].unit;
+								attackedUnit = getNextAttackableUnitIndex(-1, 1);
+								if(attackedUnit != 0xFF) {
+									controlState = unit_attack;
+									cursorX = unitList[attackedUnit].xPos;
+									cursorY = unitList[attackedUnit].yPos;
+									moveCursorInstant(cursorX, cursorY);
+								}
+							}
+						}
+						else {
+							ERROR("inv. sel um.");
+						}
+						break;
+					case BTN_B:
+						// leave unit action menu
+						controlState = scrolling;
+						break;
+					case BTN_UP:
+						// move selection up
+						selectionVar = 0; //only works because 2 choices, uncomment below if more
+						/*
+						if(selectionVar != 0) {
+							selectionVar--;
+						}
+						*/
+						break;
+					case BTN_DOWN:
+						// move selection down
+						selectionVar = 1; //only works because 2 choices, uncomment below if more
+						/*
+						if(selectionVar != 1) {
+							selectionVar++;
+						}
+						*/
+						break;
 					}
-					else {
-						ERROR("inv. sel um.");
-					}
-				}
-				if(curInput&BTN_B && !(prevInput&BTN_B)) {
-					// leave unit action menu
-					controlState = scrolling;
-				}
-				if(curInput&BTN_UP && !(prevInput&BTN_UP)) {
-					// move selection up
-					selectionVar = 0; //only works because 2 choices, uncomment below if more
-					/*
-					if(selectionVar != 0) {
-						selectionVar--;
-					}
-					*/
-				}
-				if(curInput&BTN_DOWN && !(prevInput&BTN_DOWN)) {
-					// move selection down
-					selectionVar = 1; //only works because 2 choices, uncomment below if more
-					/*
-					if(selectionVar != 1) {
-						selectionVar++;
-					}
-					*/
-				}
-				
-				break;
-				
-			case unit_movement:
-				if(curInput&BTN_LEFT && !(prevInput&BTN_LEFT)) {
-					if(movementCount > 0 && movementBuffer[movementCount-1].direction == DIR_RIGHT) {
-						movementCount--;
-						arrowX--;
-						movementPoints += movementBuffer[movementCount].movePoints;
-					}
-					else if(movementCount < 10 && validArrowTile(arrowX-1, arrowY)) {
-						movementBuffer[movementCount].direction = DIR_LEFT;
-						movementBuffer[movementCount].movePoints = getNeededMovePoints(GETUNIT(unitList[movingUnit].info), GETTERR(levelBuffer[arrowX-1][arrowY].info));
-						movementPoints -= movementBuffer[movementCount].movePoints;
-						movementCount++;
-						arrowX--;
-					}
-				}
-				if(curInput&BTN_RIGHT && !(prevInput&BTN_RIGHT)) {
-					if(movementCount > 0 && movementBuffer[movementCount-1].direction == DIR_LEFT) {
-						movementCount--;
-						arrowX++;
-						movementPoints += movementBuffer[movementCount].movePoints;
-					}
-					else if(movementCount < 10 && validArrowTile(arrowX+1, arrowY)) {
-						movementBuffer[movementCount].direction = DIR_RIGHT;
-						movementBuffer[movementCount].movePoints = getNeededMovePoints(GETUNIT(unitList[movingUnit].info), GETTERR(levelBuffer[arrowX+1][arrowY].info));
-						movementPoints -= movementBuffer[movementCount].movePoints;
-						movementCount++;
-						arrowX++;
-					}
-				}
-				if(curInput&BTN_UP && !(prevInput&BTN_UP)) {
-					if(movementCount > 0 && movementBuffer[movementCount-1].direction == DIR_DOWN) {
-						movementCount--;
-						arrowY--;
-						movementPoints += movementBuffer[movementCount].movePoints;
-					}
-					else if(movementCount < 10 && validArrowTile(arrowX, arrowY-1)) {
-						movementBuffer[movementCount].direction = DIR_UP;
-						movementBuffer[movementCount].movePoints = getNeededMovePoints(GETUNIT(unitList[movingUnit].info), GETTERR(levelBuffer[arrowX][arrowY-1].info));
-						movementPoints -= movementBuffer[movementCount].movePoints;
-						movementCount++;
-						arrowY--;
-					}
-				}
-				if(curInput&BTN_DOWN && !(prevInput&BTN_DOWN)) {
-					if(movementCount > 0 && movementBuffer[movementCount-1].direction == DIR_UP) {
-						movementCount--;
-						arrowY++;
-						movementPoints += movementBuffer[movementCount].movePoints;
-					}
-					else if(movementCount < 10 && validArrowTile(arrowX, arrowY+1)) {
-						movementBuffer[movementCount].direction = DIR_DOWN;
-						movementBuffer[movementCount].movePoints = getNeededMovePoints(GETUNIT(unitList[movingUnit].info), GETTERR(levelBuffer[arrowX][arrowY+1].info));
-						movementPoints -= movementBuffer[movementCount].movePoints;
-						movementCount++;
-						arrowY++;
+					break;
+
+				case unit_movement:
+					switch(event.button) {
+					case BTN_LEFT:
+						if(quickMove) {
+							quickSelect(DIR_LEFT);
+						}
+						else if(movementCount > 0 && movementBuffer[movementCount-1].direction == DIR_RIGHT) {
+							movementCount--;
+							arrowX--;
+							movementPoints += movementBuffer[movementCount].movePoints;
+						}
+						else if(movementCount < 10 && validArrowTile(arrowX-1, arrowY)) {
+							movementBuffer[movementCount].direction = DIR_LEFT;
+							movementBuffer[movementCount].movePoints = getNeededMovePoints(GETUNIT(unitList[movingUnit].info), GETTERR(levelBuffer[arrowX-1][arrowY].info));
+							movementPoints -= movementBuffer[movementCount].movePoints;
+							movementCount++;
+							arrowX--;
+						}
+						break;
+					case BTN_RIGHT:
+						if(quickMove) {
+							quickSelect(DIR_RIGHT);
+						}
+						else if(movementCount > 0 && movementBuffer[movementCount-1].direction == DIR_LEFT) {
+							movementCount--;
+							arrowX++;
+							movementPoints += movementBuffer[movementCount].movePoints;
+						}
+						else if(movementCount < 10 && validArrowTile(arrowX+1, arrowY)) {
+							movementBuffer[movementCount].direction = DIR_RIGHT;
+							movementBuffer[movementCount].movePoints = getNeededMovePoints(GETUNIT(unitList[movingUnit].info), GETTERR(levelBuffer[arrowX+1][arrowY].info));
+							movementPoints -= movementBuffer[movementCount].movePoints;
+							movementCount++;
+							arrowX++;
+						}
+						break;
+					case BTN_UP:
+						if(quickMove) {
+							quickSelect(DIR_UP);
+						}
+						else if(movementCount > 0 && movementBuffer[movementCount-1].direction == DIR_DOWN) {
+							movementCount--;
+							arrowY--;
+							movementPoints += movementBuffer[movementCount].movePoints;
+						}
+						else if(movementCount < 10 && validArrowTile(arrowX, arrowY-1)) {
+							movementBuffer[movementCount].direction = DIR_UP;
+							movementBuffer[movementCount].movePoints = getNeededMovePoints(GETUNIT(unitList[movingUnit].info), GETTERR(levelBuffer[arrowX][arrowY-1].info));
+							movementPoints -= movementBuffer[movementCount].movePoints;
+							movementCount++;
+							arrowY--;
+						}
+						break;
+					case BTN_DOWN:
+						if(quickMove) {
+							quickSelect(DIR_DOWN);
+						}
+						else if(movementCount > 0 && movementBuffer[movementCount-1].direction == DIR_UP) {
+							movementCount--;
+							arrowY++;
+							movementPoints += movementBuffer[movementCount].movePoints;
+						}
+						else if(movementCount < 10 && validArrowTile(arrowX, arrowY+1)) {
+							movementBuffer[movementCount].direction = DIR_DOWN;
+							movementBuffer[movementCount].movePoints = getNeededMovePoints(GETUNIT(unitList[movingUnit].info), GETTERR(levelBuffer[arrowX][arrowY+1].info));
+							movementPoints -= movementBuffer[movementCount].movePoints;
+							movementCount++;
+							arrowY++;
+						}
+						break;
+					case BTN_B:
+						// leave movement mode
+						controlState = unit_menu;
+						movementCount = 0;
+						moveCursorInstant(unitList[movingUnit].xPos, unitList[movingUnit].yPos);
+						drawLevel(LOAD_ALL);
+						break;
+					case BTN_X:
+						// toggle blink mode
+						setBlinkMode(!blinkMode);
+						break;
+					case BTN_Y:
+						// toggle quick select, the cursor goes to the end of the arrow
+						quickMove = !quickMove;
+						if(quickMove) {
+							eraseArrow();
+							routeTo(arrowX, arrowY);
+							moveCursorInstant(arrowX, arrowY);
+						}
+						else
+							moveCursorInstant(unitList[movingUnit].xPos, unitList[movingUnit].yPos);
+						break;
+					case BTN_A:
+						// move unit!
+						if(movementCount > 0) {
+							controlState = unit_moving;
+							drawLevel(LOAD_ALL);
+							moveUnit();
+							moveCursorInstant(unitList[movingUnit].xPos, unitList[movingUnit].yPos);
+							controlState = scrolling;
+							movementCount = 0;
+							drawLevel(LOAD_ALL);
+							SETHASMOVED(movingUnit, TRUE);
+						}
+						else {
+							// some error bleep
+						}
+						break;
 					}
-				}
-				if(curInput&BTN_B && !(prevInput&BTN_B)) {
-					// leave movement mode
-					controlState = unit_menu;
-					movementCount = 0;
-					drawLevel(LOAD_ALL);
-				}
-				if(curInput&BTN_X && !(prevInput&BTN_X)) {
-					// toggle blink mode
-					setBlinkMode(!blinkMode);
-				}
-				if(curInput&BTN_A && !(prevInput&BTN_A)) {
-					// move unit!
-					if(movementCount > 0) {
-						controlState = unit_moving;
+					break;
+				case unit_attack:
+					switch(event.button) {
+					case BTN_UP:
+						attackedUnit = getNextAttackableUnitIndex(attackedUnit, -1);
+						cursorX = unitList[attackedUnit].xPos;
+						cursorY = unitList[attackedUnit].yPos;
+						moveCursorInstant(cursorX, cursorY);
+						break;
+					case BTN_DOWN:
+						attackedUnit = getNextAttackableUnitIndex(attackedUnit, 1);
+						cursorX = unitList[attackedUnit].xPos;
+						cursorY = unitList[attackedUnit].yPos;
+						moveCursorInstant(cursorX, cursorY);
+						break;
+					case BTN_X:
+						// toggle blink mode
+						setBlinkMode(!blinkMode);
+						break;
+					case BTN_B:
+						// leave attack mode
+						controlState = unit_menu;
+						movementCount = 0;
+						cursorX = unitList[attackingUnit].xPos;
+						cursorY = unitList[attackingUnit].yPos;
+						moveCursorInstant(cursorX, cursorY);
 						drawLevel(LOAD_ALL);
-						moveUnit();
-						moveCursorInstant(unitList[movingUnit].xPos, unitList[movingUnit].yPos);
+						break;
+					case BTN_A:
+						attackUnit();
+						SETHASATTACKED(attackingUnit, TRUE);
+						moveCursorInstant(unitList[attackingUnit].xPos, unitList[attackingUnit].yPos);
 						controlState = scrolling;
-						movementCount = 0;
+						break;
+					}
+					break;
+				case end_turn:
+					switch(event.button) {
+					case BTN_SELECT:
+					case BTN_B:
+						// open end turn menu
+						controlState = scrolling;
+						moveCursorInstant(cursorX, cursorY);
 						drawLevel(LOAD_ALL);
-						SETHASMOVED(movingUnit, TRUE);
+						break;
+					case BTN_UP:
+					case BTN_DOWN:
+						selectionVar = !selectionVar;
+						drawTwoSelMenu(PSTR("End turn?"), PSTR("Yes"), PSTR("No"));
+						break;
+					case BTN_A:
+						if(selectionVar == 0) { // end turn
+							changeTurn();
+						}
+						else{
+							controlState = scrolling;
+							moveCursorInstant(cursorX, cursorY);
+							drawLevel(LOAD_ALL);
+						}
+						break;
 					}
-					else {
-						// some error bleep
+					break;
+				case production:
+					switch(event.button) {
+					case BTN_SELECT:
+					case BTN_B:
+						// close production menu
+						controlState = scrolling;
+						moveCursorInstant(cursorX, cursorY);
+						drawLevel(LOAD_ALL);
+						break;
+					case BTN_UP:
+						selectionVar = (selectionVar == 0) ? 4 : selectionVar-1;
+						drawProductionMenu();
+						break;
+					case BTN_DOWN:
+						selectionVar = (selectionVar == 4) ? 0 : selectionVar+1;
+						drawProductionMenu();
+						break;
+					case BTN_A:
+						if(produceUnit()) {
+							controlState = scrolling;
+							moveCursorInstant(cursorX, cursorY);
+							drawLevel(LOAD_ALL);
+						}
+						else {
+							// some error bleep
+						}
+						break;
 					}
-				}
+					break;
+				case game_over:
+					if(event.button == BTN_START)
+						SoftReset();
+					break;
+				case pause:
 
-				
-				break;
-			case unit_attack:
-				if(curInput&BTN_UP && !(prevInput&BTN_UP)) {
-					attackedUnit = getNextAttackableUnitIndex(attackedUnit, -1);
-					cursorX = unitList[attackedUnit].xPos;
-					cursorY = unitList[attackedUnit].yPos;
-					moveCursorInstant(cursorX, cursorY);
-				}
-				if(curInput&BTN_DOWN && !(prevInput&BTN_DOWN)) {
-					attackedUnit = getNextAttackableUnitIndex(attackedUnit, 1);
-					cursorX = unitList[attackedUnit].xPos;
-					cursorY = unitList[attackedUnit].yPos;
-					moveCursorInstant(cursorX, cursorY);
-				}
-				if(curInput&BTN_X && !(prevInput&BTN_X)) {
-					// toggle blink mode
-					setBlinkMode(!blinkMode);
-				}
-				if(curInput&BTN_B && !(prevInput&BTN_B)) {
-					// leave attack mode
-					controlState = unit_menu;
-					movementCount = 0;
-					cursorX = unitList[attackingUnit].xPos;
-					cursorY = unitList[attackingUnit].yPos;
-					moveCursorInstant(cursorX, cursorY);
-					drawLevel(LOAD_ALL);
-				}
+					break;
 
-				if(curInput&BTN_A && !(prevInput&BTN_A)) {
-					attackUnit();
-					SETHASATTACKED(attackingUnit, TRUE);
-					moveCursorInstant(unitList[attackingUnit].xPos, unitList[attackingUnit].yPos);
-					controlState = scrolling;
-				}
+				case menu:
 
+					break;
 
+				case unit_moving:
 
-				break;
-			case end_turn:
-				if((curInput&BTN_SELECT && !(prevInput&BTN_SELECT)) || (curInput&BTN_B && !(prevInput&BTN_B))) {
-					// open end turn menu
-					controlState = scrolling;
-					moveCursorInstant(cursorX, cursorY);
-					drawLevel(LOAD_ALL);
-				}
-				if((curInput&BTN_UP && !(prevInput&BTN_UP)) || (curInput&BTN_DOWN && !(prevInput&BTN_DOWN))) {
-					selectionVar = !selectionVar;
-					drawTwoSelMenu(PSTR("End turn?"), PSTR("Yes"), PSTR("No"));
-				}
-				if(curInput&BTN_A && !(prevInput&BTN_A)) {
-					if(selectionVar == 0) { // end turn
-						endTurn();
-						jumpToNextUnit();
-						controlState = scrolling;
-						//?
-					}
-					else{
-						controlState = scrolling;
-						moveCursorInstant(cursorX, cursorY);
-						drawLevel(LOAD_ALL);
-					}
-				}
-				break;
-			case pause:
-			
-				break;
-				
-			case menu:
-				
-				break;
-				
-			case unit_moving:
-			
-				break;
+					break;
+			}
 		}
 
-		prevInput = curInput;
 		WaitVsync_(1);
 	}
 }
@@ -790,43 +1159,181 @@ void drawScreenData() {
 
 }
 
+void drawTaskStats() {
+	// worst case scanlines per periodical, one column per task
+	unsigned char i;
+	for(i = 0; i < taskCount; i++) {
+		PrintByte(13+i*3, OVR3, taskList[i].maxLines, 0);
+		PrintByte(13+i*3, OVR4, taskList[i].lastLines, 0);
+	}
+#if SOUND_ENGINE_PROFILE == 1
+	// cycles spent in the music player, worst case then last frame
+	PrintInt(27, OVR3, GetMusicCycles(TRUE), 0);
+	PrintInt(27, OVR4, GetMusicCycles(FALSE), 0);
+#endif
+}
+
 void loadLevel(const char* level) {
-	char val, terr, owner, unit;
 	unsigned int x, y; // i know i said this wasn't needed but there will be overflow on the array access otherwise
 
-	levelWidth = pgm_read_byte(&level[0]);
-	levelHeight = pgm_read_byte(&level[1]);
+	startLevel(pgm_read_byte(&level[0]), pgm_read_byte(&level[1]));
+	currentLevel = level;
+
+	// loop y first because then we work in order. locality probably isn't an issue but eh.
+	for(y = 0; y < levelHeight; y++) {
+		for(x = 0; x < levelWidth; x++) {
+			placeLevelCell(x, y, pgm_read_byte(&level[y*levelWidth+x+2]));
+		}
+	}
+}
+
+void startLevel(unsigned char width, unsigned char height) {
+	unsigned int x;
+
+	levelWidth = width;
+	levelHeight = height;
 	if(levelHeight > 11) {
 		ERROR("inv. level height");
 	}
 
-	currentLevel = level;
+	currentLevel = NULL;
 	cameraX = 0;
 	Screen.scrollX = 0;
 	vramX = 0;
 	// reset the unit list
-	for(x = 0;x < MAX_UNITS;x++)
-		unitList[x].isUnit = FALSE;
+	initUnitPool();
+	propertyCount[0] = 0;
+	propertyCount[1] = 0;
+	baseCount[0] = 0;
+	baseCount[1] = 0;
+	// and what everyone can see, units reveal their surroundings as they are added
+	for(x = 0;x < BITMAP_SIZE;x++) {
+		visibility[0][x] = 0;
+		visibility[1][x] = 0;
+	}
+}
 
-	// loop y first because then we work in order. locality probably isn't an issue but eh.
-	for(y = 0; y < levelHeight; y++) {
-		for(x = 0; x < levelWidth; x++) {
-			val = pgm_read_byte(&level[y*levelWidth+x+2]);
-			terr = val & TERRAIN_MASK;
-			owner = val & OWNER_MASK;
-			unit = val & UNIT_MASK;
-			levelBuffer[x][y].info = terr | owner;
-			levelBuffer[x][y].unit = 0xFF;
-			if(unit != 0 && owner != NEU) {
-				//this can be a unit
-				addUnit(x, y, owner, unit);
+void placeLevelCell(unsigned char x, unsigned char y, char val) {
+	char terr, owner, unit;
+
+	terr = val & TERRAIN_MASK;
+	owner = val & OWNER_MASK;
+	unit = val & UNIT_MASK;
+	levelBuffer[x][y].info = terr;
+	levelBuffer[x][y].unit = 0xFF;
+	setPropertyOwner(x, y, owner);
+	if(unit != 0 && owner != NEU) {
+		//this can be a unit
+		addUnit(x, y, owner, unit);
+	}
+}
+
+// keeps the property lists in step with the owner bits of the map
+void setPropertyOwner(unsigned char x, unsigned char y, char player) {
+	unsigned char terr = GETTERR(levelBuffer[x][y].info);
+	unsigned char owner = GETPLAY(levelBuffer[x][y].info);
+	char isProperty = terr == CT || terr == BS;
+	unsigned char p, i;
+
+	if(isProperty && owner != NEU) {
+		p = PLINDEX(owner);
+		for(i = 0; properties[p][i].x != x || properties[p][i].y != y; i++);
+		properties[p][i] = properties[p][--propertyCount[p]];
+		if(terr == BS)
+			baseCount[p]--;
+	}
+	levelBuffer[x][y].info = terr | player;
+	if(isProperty && player != NEU) {
+		p = PLINDEX(GETPLAY(player));
+		if(propertyCount[p] == MAX_PROPERTIES)
+			ERROR("too many props");
+		properties[p][propertyCount[p]].x = x;
+		properties[p][propertyCount[p]].y = y;
+		propertyCount[p]++;
+		if(terr == BS)
+			baseCount[p]++;
+	}
+}
+
+#if ASSET_PACK == 1
+// the pack stays the open file, so no directory is searched after this
+char openPack() {
+	unsigned char header[PACK_HEADER_SIZE];
+	WORD br;
+
+	packCount = 0;
+	if(pf_mount(&packFs) == FR_OK && pf_open("ASSETS.PAK") == FR_OK &&
+			pf_read(header, PACK_HEADER_SIZE, &br) == FR_OK && br == PACK_HEADER_SIZE &&
+			memcmp_P(header, PSTR("UTPK"), 4) == 0 && header[4] == PACK_VERSION) {
+		packCount = header[6] | header[7] << 8;
+	}
+	disk_stop();
+	return packCount != 0;
+}
+
+// binary search in the index, leaves the file pointer after the entry
+unsigned int findPackAsset(unsigned int key, u32* offset) {
+	unsigned char entry[PACK_ENTRY_SIZE];
+	unsigned int low = 0, high = packCount, mid, midKey;
+	WORD br;
+
+	while(low < high) {
+		mid = (low + high) / 2;
+		if(pf_lseek(PACK_HEADER_SIZE + (u32)mid * PACK_ENTRY_SIZE) != FR_OK ||
+				pf_read(entry, PACK_ENTRY_SIZE, &br) != FR_OK || br != PACK_ENTRY_SIZE) {
+			return 0;
+		}
+		midKey = entry[0] | entry[1] << 8;
+		if(midKey == key) {
+			*offset = entry[4] | (unsigned int)entry[5] << 8 | (u32)entry[6] << 16 | (u32)entry[7] << 24;
+			return entry[2] | entry[3] << 8;
+		}
+		if(midKey < key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return 0;
+}
+
+// the song holds while the card is read, a level takes a few frames at most
+char loadPackLevel(unsigned char number) {
+	unsigned char row[MAX_LEVEL_WIDTH];
+	unsigned char x, y = 0;
+	unsigned int size;
+	u32 offset;
+	WORD br;
+
+	if(packCount == 0)
+		return FALSE;
+#if SONG_STREAMING == 1
+	PauseSongStream();
+#endif
+	size = findPackAsset(PACK_KEY(PACK_LEVEL, number), &offset);
+	if(size > 2 && pf_lseek(offset) == FR_OK && pf_read(row, 2, &br) == FR_OK && br == 2 &&
+			row[0] != 0 && row[0] <= MAX_LEVEL_WIDTH && row[1] != 0 && row[1] <= LEVEL_HEIGHT &&
+			size == 2 + (unsigned int)row[0] * row[1]) {
+		startLevel(row[0], row[1]);
+		for(y = 0; y < levelHeight; y++) {
+			if(pf_read(row, levelWidth, &br) != FR_OK || br != levelWidth)
+				break;
+			for(x = 0; x < levelWidth; x++) {
+				placeLevelCell(x, y, row[x]);
 			}
 		}
 	}
+	disk_stop();
+#if SONG_STREAMING == 1
+	ResumeSongStream();
+#endif
+	return y != 0 && y == levelHeight;
 }
+#endif
 
 void drawLevel(char dir) {
 	char x, y, bound;
+	if(threatMode && !threatValid)
+		computeThreatMap();
 	switch(dir){
 		case LOAD_ALL:
 			if(cameraX == 0) {
@@ -913,7 +1420,7 @@ void drawOverlay() {
 
 	// is there a unit here? draw info
 	// TODO: might need conditions for other overlay types, this is preliminary
-	if(levelBuffer[cursorX][cursorY].unit != 0xFF) {
+	if(isUnitVisible(cursorX, cursorY)) {
 		struct Unit* unit = &unitList[levelBuffer[cursorX][cursorY].unit];
 		Print(12, OVR1, getUnitName(unit->info));
 		drawHPBar(12, OVR2, unit->hp);
@@ -1000,6 +1507,7 @@ void drawOverlay() {
 	drawDefenseBar(3, OVR2, 100);
 
 	//drawScreenData();
+	//drawTaskStats();
 
 	// are we in unit action mode? draw the action menu (with selection arrow)
 	if(controlState == unit_menu) {
@@ -1017,13 +1525,22 @@ void drawOverlay() {
 		PrintByte(17, OVR3, movementPoints, 0);
 
 	}
+	if(controlState == unit_attack && attackedUnit != 0xFF) {
+		// damage preview for the current target
+		unsigned char min, max;
+		getDamageRange(&unitList[attackingUnit], &unitList[attackedUnit], &min, &max);
+		Print(12, OVR3, PSTR("DMG"));
+		PrintByte(17, OVR3, min, 0);
+		PrintChar(18, OVR3, '-');
+		PrintByte(21, OVR3, max, 0);
+	}
 	/*
 	if(controlState == unit_attack) {
 		PrintByte(27, OVR2, attackedUnit, 0);
 
 	}
 	*/
-	//PrintByte(12, OVR3, getRandomNumber(),FALSE);
+	//PrintByte(12, OVR3, RngNext(&gameRng),FALSE);
 }
 
 void drawArrow() {
@@ -1057,6 +1574,37 @@ void drawArrow() {
 
 }
 
+// puts the terrain back under the arrow before it is replaced
+void eraseArrow() {
+	unsigned char traverseX, traverseY, traverseI, count;
+	traverseX = unitList[movingUnit].xPos;
+	traverseY = unitList[movingUnit].yPos;
+	count = movementCount;
+	movementCount = 0;
+	for(traverseI = 0;traverseI < count;traverseI++) {
+		switch(movementBuffer[traverseI].direction) {
+		case DIR_UP:
+			traverseY--;
+			break;
+		case DIR_DOWN:
+			traverseY++;
+			break;
+		case DIR_LEFT:
+			traverseX--;
+			break;
+		case DIR_RIGHT:
+			traverseX++;
+			break;
+		}
+
+		// only what is on screen, the rest is drawn when it scrolls in
+		if(traverseX < cameraX || traverseX >= cameraX+MAX_VIS_WIDTH)
+			continue;
+
+		DrawMap2(((traverseX-cameraX)*2 + vramX)&0x1F, traverseY*2, getTileMap(traverseX, traverseY));
+	}
+}
+
 char moveCamera(char dir) {
 	switch(dir) {
 		case LOAD_LEFT:
@@ -1117,6 +1665,7 @@ char moveCursor(char direction) {
 	case DIR_UP:
 		if(cursorY == 0)
 			return FALSE;
+		playSfx(SFX_CURSOR);
 		temp = cursorY*16;
 		while(1) {
 			temp--;
@@ -1130,6 +1679,7 @@ char moveCursor(char direction) {
 	case DIR_DOWN:
 		if(cursorY == levelHeight-1)
 			return FALSE;
+		playSfx(SFX_CURSOR);
 		temp = cursorY*16;
 		while(1) {
 			temp++;
@@ -1143,6 +1693,7 @@ char moveCursor(char direction) {
 	case DIR_LEFT:
 		if(cursorX == 0)
 			return FALSE;
+		playSfx(SFX_CURSOR);
 		if(cameraX > 0) {
 			if(cursorX-cameraX == 1) { // converts to screen coords
 				// we want to shift the screen, not the cursor itself
@@ -1165,6 +1716,7 @@ char moveCursor(char direction) {
 	case DIR_RIGHT:
 		if(cursorX == levelWidth-1)
 			return FALSE;
+		playSfx(SFX_CURSOR);
 		if(cameraX < levelWidth-MAX_VIS_WIDTH) {
 			if(cursorX-cameraX == MAX_VIS_WIDTH-2) { // right edge, screen coords
 				moveCamera(LOAD_RIGHT);
@@ -1187,7 +1739,8 @@ char moveCursor(char direction) {
 	return TRUE;
 }
 
-char moveCursorInstant(unsigned char x, unsigned char y) {
+// the camera position that puts the column in the middle of the screen
+unsigned char getCenteredCameraX(unsigned char x) {
 	char normalizedCameraX;
 
 	normalizedCameraX = (char)x - MAX_VIS_WIDTH/2;
@@ -1201,7 +1754,11 @@ char moveCursorInstant(unsigned char x, unsigned char y) {
 	//PrintByte(19, OVR4, normalizedCameraX, 0);
 	//WaitVsync_(60);
 
-	moveCameraInstant(normalizedCameraX);
+	return normalizedCameraX;
+}
+
+char moveCursorInstant(unsigned char x, unsigned char y) {
+	moveCameraInstant(getCenteredCameraX(x));
 
 	cursorX = x;
 	cursorY = y;
@@ -1211,6 +1768,21 @@ char moveCursorInstant(unsigned char x, unsigned char y) {
 	return TRUE;
 }
 
+// like moveCursorInstant, but the camera stays put while the square is in
+// the columns moveCursor reaches without scrolling
+char moveCursorInView(unsigned char x, unsigned char y) {
+	int left = cameraX == 0 ? 0 : cameraX+1;
+	int right = cameraX >= levelWidth-MAX_VIS_WIDTH ? cameraX+MAX_VIS_WIDTH-1 : cameraX+MAX_VIS_WIDTH-2;
+
+	if(x < left || x > right)
+		return moveCursorInstant(x, y);
+
+	cursorX = x;
+	cursorY = y;
+	MoveSprite(0, (cursorX-cameraX)*16, cursorY*16, 2, 2);
+	return TRUE;
+}
+
 
 void moveUnit() {
 	uint8_t traverseX, traverseY, traverseI;
@@ -1245,17 +1817,22 @@ void moveUnit() {
 				newY = traverseY;
 		}
 
+		playSfx(SFX_STEP);
 		tweenUnitSprite(traverseX, traverseY, newX, newY);
 		traverseX = newX;
 		traverseY = newY;
 	}
 
 	//newX and newY will be the final coords
+	hideSight(movingUnit);
 	levelBuffer[unitList[movingUnit].xPos][unitList[movingUnit].yPos].unit = 0xFF;
 	unitList[movingUnit].xPos = newX;
 	unitList[movingUnit].yPos = newY;
 	levelBuffer[unitList[movingUnit].xPos][unitList[movingUnit].yPos].unit = movingUnit;
+	revealSight(movingUnit);
+	threatValid = FALSE;
 	MoveSprite(4, -16, 0, 2, 2);
+	tlmSendEvent(TLM_MOVE, movingUnit, unitList[movingUnit].info, newX, newY);
 }
 
 void tweenUnitSprite(char sx, char sy, char dx, char dy) {
@@ -1331,18 +1908,36 @@ char validArrowTile(unsigned char x, unsigned char y) {
 	return TRUE;
 }
 
+void setThreatMode(char active) {
+	threatMode = active;
+	drawLevel(LOAD_ALL); // builds the map if it's stale
+}
+
 void setBlinkMode(char active) {
 	blinkMode = active;
-	blinkCounter = 0;
 	blinkState = BLINK_UNITS;
+	setTaskEnabled(blinkTask, active);
 	redrawUnits();
 }
 
 
-//TODO: MAX units *per* team, not total units
-//TODO: unit adding (and probably removing) is FLAWED, needs to be redone
+// resets the unit list and chains every slot into the free list
+void initUnitPool() {
+	unsigned char i;
+	for(i = 0; i < MAX_UNITS; i++) {
+		unitList[i].isUnit = FALSE;
+		unitNext[i] = i+1;
+	}
+	unitNext[MAX_UNITS-1] = 0xFF;
+	unitFirstEmpty = 0;
+	unitFirstOwned[0] = 0xFF;
+	unitFirstOwned[1] = 0xFF;
+	unitCount[0] = 0;
+	unitCount[1] = 0;
+}
+
 unsigned char addUnit(unsigned char x, unsigned char y, char player, char type) {
-	char ret;
+	unsigned char ret;
 
 	if(levelBuffer[x][y].unit != 0xFF)
 	{
@@ -1354,67 +1949,276 @@ unsigned char addUnit(unsigned char x, unsigned char y, char player, char type)
 		//ERROR("Unit list fulL!");
 		return 0xFF;
 	}
-	else
+	else if (unitCount[PLINDEX(GETPLAY(player))] >= MAX_TEAM_UNITS)
 	{
-		unitList[unitFirstEmpty].isUnit = TRUE;
-		unitList[unitFirstEmpty].hp = 100;
-		unitList[unitFirstEmpty].info = player | type;
-		unitList[unitFirstEmpty].xPos = x;
-		unitList[unitFirstEmpty].yPos = y;
-		levelBuffer[x][y].unit = unitFirstEmpty;
-		ret = unitFirstEmpty;
-		
-
-		/*
-		for(int i = unitFirstEmpty+1; i < MAX_UNITS-1; i++) //Starting from 1+ the known earliest empty space, search for the next empty space.
-		{
-			if(!unitList[i].isUnit) 
-			{
-				unitFirstEmpty = i;
-				break;
-			} 
-			else if(i == MAX_UNITS-1) //If we reach the end of the units list, the list is full. 
-				unitFirstEmpty = 0xFF;
+		// team is at its cap
+		return 0xFF;
+	}
+
+	// move the head of the free list to the player's units
+	ret = unitFirstEmpty;
+	unitFirstEmpty = unitNext[ret];
+	unitNext[ret] = unitFirstOwned[PLINDEX(GETPLAY(player))];
+	unitFirstOwned[PLINDEX(GETPLAY(player))] = ret;
+	unitCount[PLINDEX(GETPLAY(player))]++;
+
+	unitList[ret].isUnit = TRUE;
+	unitList[ret].hp = 100;
+	unitList[ret].info = player | type;
+	unitList[ret].other = 0;
+	unitList[ret].xPos = x;
+	unitList[ret].yPos = y;
+	levelBuffer[x][y].unit = ret;
+	revealSight(ret);
+	threatValid = FALSE;
+
+	return ret;
+}
+
+void removeUnit(unsigned char x, unsigned char y) {
+	if(levelBuffer[x][y].unit == 0xFF)
+		ERROR("ru");
+
+	removeUnitByIndex(levelBuffer[x][y].unit);
+}
+
+void removeUnitByIndex(unsigned char unit) {
+	unsigned char* link;
+
+	if(unit >= MAX_UNITS || !unitList[unit].isUnit)
+		ERROR("rubi");
+
+	hideSight(unit);
+	unitList[unit].isUnit = FALSE;
+	levelBuffer[unitList[unit].xPos][unitList[unit].yPos].unit = 0xFF; //Mark this grid buffer square as no unit.
+	unitCount[PLINDEX(GETPLAY(unitList[unit].info))]--;
+	threatValid = FALSE;
+
+	// unlink it from its owner's units and push the slot back on the free list
+	link = &unitFirstOwned[PLINDEX(GETPLAY(unitList[unit].info))];
+	while(*link != unit)
+		link = &unitNext[*link];
+	*link = unitNext[unit];
+	unitNext[unit] = unitFirstEmpty;
+	unitFirstEmpty = unit;
+}
+
+// marks every square within the unit's sight as visible for its owner
+void revealSight(unsigned char unit) {
+	signed char x, y, dx, r;
+	unsigned char p = PLINDEX(GETPLAY(unitList[unit].info));
+	r = getSightRange(unitList[unit].info);
+
+	for(dx = -r; dx <= r; dx++) {
+		x = unitList[unit].xPos + dx;
+		if(x < 0 || x >= levelWidth)
+			continue;
+		for(y = unitList[unit].yPos - (r - ABS(dx)); y <= unitList[unit].yPos + (r - ABS(dx)); y++) {
+			if(y < 0 || y >= levelHeight)
+				continue;
+			SETVISIBLE(p, x, y);
 		}
-		*/
+	}
+}
 
-		for(unsigned char i = unitFirstEmpty; ;) {
-			if(!unitList[i].isUnit) {
-				unitFirstEmpty = i;
-				break;
+// takes the unit's sight away from its owner. squares that another friendly
+// unit can still see are given back by revealing only the units that overlap.
+void hideSight(unsigned char unit) {
+	signed char x, y, dx, r;
+	unsigned char i, ux, uy;
+	unsigned char player = GETPLAY(unitList[unit].info);
+	unsigned char p = PLINDEX(player);
+	ux = unitList[unit].xPos;
+	uy = unitList[unit].yPos;
+	r = getSightRange(unitList[unit].info);
+
+	for(dx = -r; dx <= r; dx++) {
+		x = ux + dx;
+		if(x < 0 || x >= levelWidth)
+			continue;
+		for(y = uy - (r - ABS(dx)); y <= uy + (r - ABS(dx)); y++) {
+			if(y < 0 || y >= levelHeight)
+				continue;
+			CLRVISIBLE(p, x, y);
+		}
+	}
+
+	for(i = 0; i < MAX_UNITS; i++) {
+		if(i == unit || !unitList[i].isUnit || GETPLAY(unitList[i].info) != player)
+			continue;
+		if(MANH(unitList[i].xPos, unitList[i].yPos, ux, uy) <= r + getSightRange(unitList[i].info))
+			revealSight(i);
+	}
+}
+
+// is there a unit on this square that the active player is allowed to see?
+char isUnitVisible(unsigned char x, unsigned char y) {
+	unsigned char unit = levelBuffer[x][y].unit;
+	if(unit == 0xFF)
+		return FALSE;
+	if(GETPLAY(unitList[unit].info) == activePlayer)
+		return TRUE;
+	return ISVISIBLE(PLINDEX(activePlayer), x, y) ? TRUE : FALSE;
+}
+
+// finds every square the other player could attack next turn. for each unit
+// type present, all of its units seed one search at once, the reachable
+// area is then grown by the attack range.
+void computeThreatMap() {
+	unsigned char i, x, y, t;
+	unsigned char enemy = (activePlayer == PL1) ? PL2 : PL1;
+	char found, range;
+
+	for(i = 0; i < BITMAP_SIZE; i++)
+		threatMap[i] = 0;
+	moveMapUnit = 0xFF;
+
+	for(t = UN1; t <= UN5; t += UN1) {
+		for(i = 0; i < COSTMAP_SIZE; i++)
+			costMap[i] = 0;
+
+		found = FALSE;
+		for(i = 0; i < MAX_UNITS; i++) {
+			if(unitList[i].isUnit && GETPLAY(unitList[i].info) == enemy && GETUNIT(unitList[i].info) == t &&
+					isUnitVisible(unitList[i].xPos, unitList[i].yPos)) {
+				SETCOST(unitList[i].xPos, unitList[i].yPos, MAX_UNIT_MP+1);
+				found = TRUE;
 			}
+		}
+		if(!found)
+			continue;
+		spreadMovePoints(t);
 
-			i = (i+1)%MAX_UNITS;
-			if(i == unitFirstEmpty) {
-				unitFirstEmpty = 0xFF;
-				break;
+		range = getAttackRange(t);
+		for(x = 0; x < levelWidth; x++) {
+			for(y = 0; y < levelHeight; y++) {
+				if(GETCOST(x, y))
+					markAttackArea(x, y, range);
 			}
 		}
-		
-		return ret;
 	}
+
+	threatValid = TRUE;
 }
 
-void removeUnit(unsigned char x, unsigned char y) {
-	if(levelBuffer[x][y].unit == 0xFF)
-		ERROR("ru");
+// grows the seeded squares of costMap into everything a unit of the type
+// can reach. squares are visited in order of remaining movement points, so
+// each one settles the first time it is expanded, with its cheapest cost.
+void spreadMovePoints(char type) {
+	unsigned char x, y, mp, need, nx, ny, d;
+
+	for(mp = MAX_UNIT_MP+1; mp > 1; mp--) {
+		for(x = 0; x < levelWidth; x++) {
+			for(y = 0; y < levelHeight; y++) {
+				if(GETCOST(x, y) != mp)
+					continue;
+				for(d = 0; d < 4; d++) {
+					nx = x + (d == 0) - (d == 1);
+					ny = y + (d == 2) - (d == 3);
+					if(nx >= levelWidth || ny >= levelHeight || levelBuffer[nx][ny].unit != 0xFF)
+						continue;
+					need = getNeededMovePoints(type, GETTERR(levelBuffer[nx][ny].info));
+					if(need < mp && mp-need > GETCOST(nx, ny))
+						SETCOST(nx, ny, mp-need);
+				}
+			}
+		}
+	}
+}
+
+// the cheapest route to every square is kept implicitly: walking back from
+// a square, the previous one is a neighbour that had exactly the points
+// spent to enter it more. so one search answers every destination.
+void computeMoveMap(unsigned char index) {
+	unsigned char i;
+
+	for(i = 0; i < COSTMAP_SIZE; i++)
+		costMap[i] = 0;
+	SETCOST(unitList[index].xPos, unitList[index].yPos, MAX_UNIT_MP+1);
+	spreadMovePoints(GETUNIT(unitList[index].info));
+	moveMapUnit = index;
+}
 
-	unitList[levelBuffer[x][y].unit].isUnit = FALSE;
-	//memset(&unitList[levelBuffer[x][y].unit], sizeof(unitList[levelBuffer[x][y].unit]), 0); //Zero out the unit struct.
+// replaces the arrow of movingUnit with its cheapest route to the square
+char routeTo(unsigned char x, unsigned char y) {
+	unsigned char mp, need, nx, ny, d, steps = 0, i;
+	struct Movement step;
 
-	//if(unitFirstEmpty > (levelBuffer[x][y].unit + (levelBuffer[x][y].unit < unitFirstEmpty) * MAX_UNITS) ) //If this newly opened index is earlier than the last known index, change it accordingly.
-	unitFirstEmpty = levelBuffer[x][y].unit;
-	levelBuffer[x][y].unit = 0xFF; //Mark this grid buffer square as no unit.
+	if(x >= levelWidth || y >= levelHeight)
+		return FALSE;
+	if(moveMapUnit != movingUnit)
+		computeMoveMap(movingUnit);
+	mp = GETCOST(x, y);
+	if(mp == 0)
+		return FALSE;
 
+	arrowX = x;
+	arrowY = y;
+	movementPoints = mp-1;
+	// from the end back to the unit, then turned around
+	while(mp != MAX_UNIT_MP+1) {
+		need = getNeededMovePoints(GETUNIT(unitList[movingUnit].info), GETTERR(levelBuffer[x][y].info));
+		for(d = 0; d < 4; d++) {
+			nx = x + (d == 0) - (d == 1);
+			ny = y + (d == 2) - (d == 3);
+			if(nx < levelWidth && ny < levelHeight && GETCOST(nx, ny) == mp+need)
+				break;
+		}
+		if(d == 4 || steps == 10)
+			ERROR("inv. route");
+		movementBuffer[steps].direction = d == 0 ? DIR_LEFT : d == 1 ? DIR_RIGHT : d == 2 ? DIR_UP : DIR_DOWN;
+		movementBuffer[steps].movePoints = need;
+		steps++;
+		x = nx;
+		y = ny;
+		mp += need;
+	}
+	for(i = 0; i < steps/2; i++) {
+		step = movementBuffer[i];
+		movementBuffer[i] = movementBuffer[steps-1-i];
+		movementBuffer[steps-1-i] = step;
+	}
+	movementCount = steps;
+	return TRUE;
 }
 
-void removeUnitByIndex(unsigned char unit) {
-	if(unit > MAX_UNITS)
-		ERROR("rubi");
+// moves the cursor on to the next square in the direction the unit can
+// reach, stepping over the ones it can't, and routes the arrow there.
+// The cursor jumps in one go instead of gliding over every square between
+char quickSelect(char dir) {
+	unsigned char x = cursorX, y = cursorY;
+
+	if(moveMapUnit != movingUnit)
+		computeMoveMap(movingUnit);
+	do {
+		x += (dir == DIR_RIGHT) - (dir == DIR_LEFT);
+		y += (dir == DIR_DOWN) - (dir == DIR_UP);
+		if(x >= levelWidth || y >= levelHeight)
+			return FALSE;
+	} while(GETCOST(x, y) == 0);
 
-	unitList[unit].isUnit = FALSE;
-	unitFirstEmpty = unit;
-	levelBuffer[unitList[unit].xPos][unitList[unit].yPos].unit = 0xFF;
+	eraseArrow();
+	routeTo(x, y);
+	playSfx(SFX_CURSOR);
+	moveCursorInView(x, y);
+	return TRUE;
+}
+
+// same reach as getNextAttackableUnitIndex: range 1 includes the diagonals
+void markAttackArea(unsigned char x, unsigned char y, char range) {
+	signed char dx, dy, tx, ty;
+	for(dx = -range; dx <= range; dx++) {
+		tx = x + dx;
+		if(tx < 0 || tx >= levelWidth)
+			continue;
+		for(dy = -range; dy <= range; dy++) {
+			ty = y + dy;
+			if(ty < 0 || ty >= levelHeight)
+				continue;
+			if(range == 1 || ABS(dx) + ABS(dy) <= range)
+				SETCELLBIT(threatMap, tx, ty);
+		}
+	}
 }
 
 unsigned char getNextAttackableUnitIndex(signed char last, char dir) {
@@ -1434,14 +2238,14 @@ unsigned char getNextAttackableUnitIndex(signed char last, char dir) {
 		if(i < 0)
 			i = MAX_UNITS-1;
 
-		if(unitList[i].isUnit && GETPLAY(unitList[i].info) == player) {
+		if(unitList[i].isUnit && GETPLAY(unitList[i].info) == player && isUnitVisible(unitList[i].xPos, unitList[i].yPos)) {
 			if(range == 1 && ABS(unitList[i].xPos - unitList[attackingUnit].xPos) == 1 && ABS(unitList[i].yPos - unitList[attackingUnit].yPos) == 1)
 				return i;
 			else if(MANH(unitList[i].xPos, unitList[i].yPos, unitList[attackingUnit].xPos, unitList[attackingUnit].yPos) <= range)
 				return i;
 		}
 	}
-	if(unitList[last].isUnit && GETPLAY(unitList[last].info) == player) {
+	if(unitList[last].isUnit && GETPLAY(unitList[last].info) == player && isUnitVisible(unitList[last].xPos, unitList[last].yPos)) {
 		if(range == 1 && ABS(unitList[last].xPos - unitList[attackingUnit].xPos) == 1 && ABS(unitList[last].yPos - unitList[attackingUnit].yPos) == 1)
 			return last;
 		else if(MANH(unitList[last].xPos, unitList[last].yPos, unitList[attackingUnit].xPos, unitList[attackingUnit].yPos) <= range)
@@ -1461,7 +2265,7 @@ const char* getTileMap(unsigned char x, unsigned char y) {
 	}
 
 	terrain = GETTERR(levelBuffer[x][y].info);
-	if(levelBuffer[x][y].unit != 0xff) {
+	if(isUnitVisible(x, y)) {
 		unit = GETUNIT(unitList[levelBuffer[x][y].unit].info);
 		unitOwner = GETPLAY(unitList[levelBuffer[x][y].unit].info);
 	}
@@ -1572,6 +2376,10 @@ const char* getTileMap(unsigned char x, unsigned char y) {
 	}
 
 
+	if(!displayUnit && threatMode && GETCELLBIT(threatMap, x, y)) {
+		return map_threat;
+	}
+
 	if(displayUnit) {
 		switch(unit) { // all of these need placeholders
 		case UN1:
@@ -1814,283 +2622,231 @@ void drawDefenseBar(unsigned char x, unsigned char y, char val) {
 
 }
 
+// unit rules are generated by tools/rulesgen.c from res/rules.txt into res/rules.inc
 const char* getUnitName(unsigned char unit) {
-	switch(GETUNIT(unit)) {
-	case UN1:
-		return PSTR("Infantry");
-	case UN2:
-		return PSTR("Tank");
-	case UN3:
-		return PSTR("Mortar");
-	case UN4:
-		return PSTR("Mercenary");
-	case UN5:
-		return PSTR("Rocket");
-	default:
+	uint8_t u = INDEXUNIT(GETUNIT(unit))-1;
+	if(u >= RULES_UNITS)
 		ERROR("inv. unit");
-	}
-
+	return &_unitNames[u*RULES_NAME_SIZE];
 }
 
 char getNeededMovePoints(const char unit, const char terrain) {
-	//oh god save me please
-	switch(unit|terrain) {
-		case UN1|BS:
-		case UN2|BS:
-		case UN4|BS:
-		case UN5|BS:
-			return 1;
-		case UN1|PL:
-		case UN2|PL:
-		case UN4|PL:
-		case UN5|PL:
-		case UN4|FO:
-		case UN1|CT:
-		case UN4|CT:
-		case UN5|CT:
-		case UN3|BS:
-			return 2;
-		case UN1|FO:
-		case UN3|PL:
-		case UN5|FO:
-		case UN2|CT:
-		case UN3|CT:
-			return 3;
-		case UN2|FO:
-			return 4;
-		case UN3|FO:
-			return 5;
-		case UN4|MO:
-		case UN5|MO:
-			return 7;
-		case UN1|MO:
-			return 8;
-		case UN2|MO:
-		case UN3|MO:
-			return 11;
-		default:
-			ERROR("gnmp");
-	}
+	uint8_t u = INDEXUNIT(GETUNIT(unit))-1;
+	uint8_t t = INDEXTERR(GETTERR(terrain))-1;
+	if(u >= RULES_UNITS || t >= RULES_TERRAINS)
+		ERROR("gnmp");
+	return pgm_read_byte(&_unitRules[u*RULES_UNIT_SIZE+RULES_MOVE+t]);
 }
 
-const char _damage[] PROGMEM = {
-	25, 15, 15, 25, 35,
-	25, 35, 25, 15, 15,
-	15, 35, 25, 25, 15,
-	35, 25, 25, 15, 35,
-	15, 35, 35, 15, 15
-};
-
-char getDamage(struct Unit* srcUnit, struct Unit* dstUnit) {
-	char baseDamage = 0;
-
+// looks up the {min, max} damage of a hit, precomputed by tools/rulesgen.c
+// from the base damage and terrain rules
+void getDamageRange(struct Unit* srcUnit, struct Unit* dstUnit, unsigned char* min, unsigned char* max) {
 	// src index and dst index
 	// shifts the unit number so it can be used as an index
 	uint8_t src = INDEXUNIT(GETUNIT(srcUnit->info))-1;
 	uint8_t dst = INDEXUNIT(GETUNIT(dstUnit->info))-1;
+	uint8_t terr = INDEXTERR(GETTERR(levelBuffer[dstUnit->xPos][dstUnit->yPos].info))-1;
+	const unsigned char* entry;
 
-	baseDamage = pgm_read_byte(&_damage[src*5+dst]);
+	if(src >= RULES_UNITS || dst >= RULES_UNITS || terr >= RULES_TERRAINS)
+		ERROR("inv. dmg");
 
-/* old lookup routine; is 200 bytes more!
-	// get base damage (unit -> unit)
-	switch(GETUNIT(srcUnit->info)) {
-	case UN1:
-		switch(GETUNIT(dstUnit->info)) {
-		case UN2:
-		case UN3:
-			baseDamage = 15;
-			break;
-		case UN1:
-		case UN4:
-			baseDamage = 25;
-			break;
-		case UN5:
-			baseDamage = 35;
-			break;
-		}
-		break;
-	case UN2:
-		switch(GETUNIT(dstUnit->info)) {
-		case UN4:
-		case UN5:
-			baseDamage = 15;
-			break;
-		case UN1:
-		case UN3:
-			baseDamage = 25;
-			break;
-		case UN2:
-			baseDamage = 35;
-			break;
-		}
-		break;
-	case UN3:
-		switch(GETUNIT(dstUnit->info)) {
-		case UN1:
-		case UN5:
-			baseDamage = 15;
-			break;
-		case UN3:
-		case UN4:
-			baseDamage = 25;
-			break;
-		case UN2:
-			baseDamage = 35;
-			break;
-		}
-		break;
-	case UN4:
-		switch(GETUNIT(dstUnit->info)) {
-		case UN4:
-			baseDamage = 15;
-			break;
-		case UN2:
-		case UN3:
-			baseDamage = 25;
-			break;
-		case UN1:
-		case UN5:
-			baseDamage = 35;
-			break;
-		}
-		break;
-	case UN5:
-		switch(GETUNIT(dstUnit->info)) {
-		case UN1:
-		case UN4:
-		case UN5:
-			baseDamage = 15;
-			break;
-		case UN2:
-		case UN3:
-			baseDamage = 35;
-			break;
-		}
-		break;
-	}*/
+	entry = &_damageRange[((src*RULES_UNITS+dst)*RULES_TERRAINS+terr)*2];
+	*min = pgm_read_byte(&entry[0]);
+	*max = pgm_read_byte(&entry[1]);
+}
 
-	// get random boost (0-10 extra)
-	baseDamage += getRandomNumberLimit(10);
+char getDamage(struct Unit* srcUnit, struct Unit* dstUnit) {
+	unsigned char min, max;
 
-	//terrain resistance
-	switch(GETTERR(levelBuffer[dstUnit->xPos][dstUnit->yPos].info)) {
-	case BS:
-		if(GETUNIT(srcUnit->info) == UN3)
-			baseDamage -= 5; // mortar vs base
-		else
-			baseDamage -= 10;
-		break;
-	case MO:
-		baseDamage -= 8;
-		break;
-	case FO:
-		baseDamage -= 5;
-		break;
-	case CT:
-		if(GETUNIT(srcUnit->info) != UN3)
-			baseDamage -= 5;
-	}
-	if(baseDamage <= 0)
-		baseDamage = 1;
+	getDamageRange(srcUnit, dstUnit, &min, &max);
 
-	return baseDamage;
+	// random boost across the range
+	return min + RngRange(&gameRng, max - min + 1);
 }
 
-const char _range[] PROGMEM = {
-	1, 1, 3, 1, 2
-};
-
 char getAttackRange(const char unit) {
 	uint8_t u = INDEXUNIT(GETUNIT(unit))-1;
-	if(u >= 5)
-		ERROR("inv. u ar");
-	return pgm_read_byte(&_range[u]);
-	/*
-	switch(GETUNIT(unit)) {
-	case UN1:
-	case UN2:
-	case UN4:
-		return 1;
-	case UN5:
-		return 2;
-	case UN3:
-		return 3;
-	default:
+	if(u >= RULES_UNITS)
 		ERROR("inv. u ar");
-	}
-	return 1;*/
+	return pgm_read_byte(&_unitRules[u*RULES_UNIT_SIZE+RULES_RANGE]);
 }
 
-char getRandomNumberLimit(char max) {
-	char a = getRandomNumber();
-	if(a < 0)
-		a = -a;
-	return a % (max+1);
+char getSightRange(const char unit) {
+	uint8_t u = INDEXUNIT(GETUNIT(unit))-1;
+	if(u >= RULES_UNITS)
+		ERROR("inv. u sr");
+	return pgm_read_byte(&_unitRules[u*RULES_UNIT_SIZE+RULES_SIGHT]);
 }
 
-char getRandomNumber() {
-	unsigned char lo, hi, xor, save;
+unsigned char getUnitCost(const char unit) {
+	uint8_t u = INDEXUNIT(GETUNIT(unit))-1;
+	if(u >= RULES_UNITS)
+		ERROR("inv. u cost");
+	return pgm_read_byte(&_unitRules[u*RULES_UNIT_SIZE+RULES_COST]);
+}
 
-	lo = (unsigned char)eepromData.data[0];
-	hi = (unsigned char)eepromData.data[1];
+// higher priority effects steal the voice from lower ones, never the other way
+const unsigned char _sfxPriority[] PROGMEM = {
+	1, 2, 4, 3
+};
 
-	if(!hi && !lo)
-		lo = 0x31; // some good normal value
+void playSfx(unsigned char sfx) {
+	if(sfx >= 4)
+		ERROR("inv. sfx");
+	TriggerFxPriority(sfx, SFX_VOLUME, pgm_read_byte(&_sfxPriority[sfx]));
+}
 
-	xor =  lo&1;
-	xor ^= (lo>>2)&1;
-	xor ^= (lo>>3)&1;
-	xor ^= (lo>>5)&1;
+unsigned char addTask(void (*run)(void), unsigned char period, unsigned int stateMask) {
+	struct PeriodicTask* task;
 
-	save = hi&1;
-	hi = ((hi>>1)&0x7F)|(xor<<7);
-	lo = ((lo>>1)&0x7F)|(save<<7);
+	if(taskCount >= MAX_TASKS)
+		ERROR("task list full");
 
-	eepromData.data[0] = (char)lo;
-	eepromData.data[1] = (char)hi;
+	task = &taskList[taskCount];
+	task->run = run;
+	task->period = period;
+	task->counter = 0;
+	task->enabled = TRUE;
+	task->stateMask = stateMask;
+	task->lastLines = 0;
+	task->maxLines = 0;
+	task->totalLines = 0;
 
-	return (char)lo;
+	return taskCount++;
 }
 
-void WaitVsync_(char count) {
-	// this is used for periodicals like blink and cursor alternation
-	// call this instead of WaitVsync to make sure that periodicals
-	// get called even if we are doing something function-locked
-	while(count > 0) {
+void setTaskEnabled(unsigned char index, char active) {
+	if(index >= taskCount)
+		return;
+	taskList[index].enabled = active;
+	taskList[index].counter = 0;
+}
 
+void runTasks() {
+	unsigned char i, start;
+	struct PeriodicTask* task;
 
-		// insert periodicals here
-		//TODO: make sure the correct periodicals only fire when they are supposed to
-		if(cursorCounter >= 40) {
-			cursorCounter = 0;
-			mapCursorSprite(cursorAlt);
-			cursorAlt = !cursorAlt;
+	for(i = 0; i < taskCount; i++) {
+		task = &taskList[i];
+		if(!task->enabled || !(task->stateMask & STATE_BIT(controlState))) {
+			// restart the period once the task gets to run again
+			task->counter = 0;
+			continue;
 		}
-		cursorCounter++;
 
-		if(controlState == unit_movement) {
-			drawArrow();
-		}
+		if(++task->counter < task->period)
+			continue;
+		task->counter = 0;
+
+		start = sync_pulse;
+		task->run();
+		task->lastLines = getElapsedLines(start);
+		if(task->lastLines > task->maxLines)
+			task->maxLines = task->lastLines;
+		task->totalLines += task->lastLines;
+	}
+}
 
+unsigned char getElapsedLines(unsigned char start) {
+	unsigned char now = sync_pulse;
+	if(now <= start)
+		return start - now;
+	// went through vsync, the counter was reloaded
+	return start + (SYNC_HSYNC_PULSES - now);
+}
 
+void taskCursorAlternate() {
+	mapCursorSprite(cursorAlt);
+	cursorAlt = !cursorAlt;
+}
 
-		if(controlState != end_turn && blinkMode) {
-			if(blinkCounter >= 30) {
-				// toggle blink
-				blinkState = !blinkState;
-				redrawUnits();
-				blinkCounter = 0;
-			}
-			blinkCounter++;
-		}
-		else {
-			blinkCounter = 0;
-		}
+void taskArrow() {
+	drawArrow();
+}
 
+void taskBlink() {
+	blinkState = !blinkState;
+	redrawUnits();
+}
 
+// saves the rng state in the next journal slot, the kernel writes it out during vsync
+// the previous save stays intact until this one is complete
+void saveEeprom() {
+	eepromData.data[0] = gameRng.state;
+	eepromData.data[1] = gameRng.state >> 8;
+	eepromData.data[2] = gameRng.state >> 16;
+	eepromData.data[3] = gameRng.state >> 24;
+	EepromJournalSave(&eepromJournal, eepromData.data);
+}
+
+void WaitVsync_(char count) {
+	// this is used for periodicals like blink and cursor alternation
+	// call this instead of WaitVsync to make sure that periodicals
+	// get called even if we are doing something function-locked
+	while(count > 0) {
+#if TELEMETRY == 1
+		// the vsync flag is already up if the frame ran late
+		unsigned char gameLines = GetVsyncFlag() ? TLM_OVERRUN : getElapsedLines(tlmFrameStart);
+		unsigned char start = sync_pulse;
+#endif
+		runTasks();
+#if TELEMETRY == 1
+		tlmSendFrame(gameLines, getElapsedLines(start));
+#endif
 
 		WaitVsync(1); // wait only once
 		count--;
+#if TELEMETRY == 1
+		tlmFrameStart = sync_pulse;
+#endif
 	}
 
 }
+
+#if TELEMETRY == 1
+void tlmSendFrame(unsigned char gameLines, unsigned char taskLines) {
+	unsigned char packet[12];
+	struct UartStats stats;
+	unsigned int v;
+
+	GetUartStats(&stats);
+	packet[0] = TLM_FRAME;
+	packet[1] = tlmFrame & 0xFF;
+	packet[2] = tlmFrame >> 8;
+	packet[3] = controlState;
+	packet[4] = gameLines;
+	packet[5] = taskLines;
+	packet[6] = free_tile_index;
+#if STACK_MONITOR == 1
+	v = StackFree();
+#else
+	v = 0xFFFF;
+#endif
+	packet[7] = v & 0xFF;
+	packet[8] = v >> 8;
+#if SOUND_ENGINE_PROFILE == 1
+	v = GetMusicCycles(FALSE);
+#else
+	v = 0;
+#endif
+	packet[9] = v & 0xFF;
+	packet[10] = v >> 8;
+	packet[11] = stats.txOverflows;
+	UartSendPacket(packet, sizeof(packet));
+	tlmFrame++;
+}
+
+void tlmSendEvent(unsigned char type, unsigned char a, unsigned char b, unsigned char c, unsigned char d) {
+	unsigned char packet[7];
+
+	packet[0] = type;
+	packet[1] = tlmFrame & 0xFF;
+	packet[2] = tlmFrame >> 8;
+	packet[3] = a;
+	packet[4] = b;
+	packet[5] = c;
+	packet[6] = d;
+	UartSendPacket(packet, sizeof(packet));
+}
+#endif
@@ -0,0 +1,311 @@
+/*
+ * End of turn benchmark, compares the full map scan endTurn used to do
+ * with the per-player unit and property lists it keeps now.
+ *
+ * Both run side by side on random maps with the same random play: units
+ * walk onto cities and bases to capture them, some die and new ones are
+ * built. After every turn the two maps, credits and property flags must
+ * be the same. The level code is a copy of tacticsCore.c, with the map
+ * and the lists made large enough for maps up to 64x64.
+ *
+ * Per map size it prints the squares, units and properties visited per
+ * turn, which is what costs on the console, and the host time per turn.
+ *
+ * Build and run on the host:
+ *   gcc -O2 -o econbench econbench.c
+ *   ./econbench [-n turns] [-p property %] [-u units per player] [WxH...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_WIDTH 64
+#define MAX_HEIGHT 64
+#define MAX_UNITS 128
+#define MAX_PROPERTIES (MAX_WIDTH * MAX_HEIGHT)
+
+// as in tacticsCore.c
+#define PL 0x01
+#define CT 0x04
+#define BS 0x05
+#define PL1 0x80
+#define PL2 0x40
+#define NEU 0x00
+#define TERRAIN_MASK 0x07
+#define OWNER_MASK 0xC0
+#define HASPROD_MASK 0x08
+#define PLINDEX(pl) ((pl) == PL1 ? 0 : 1)
+#define ISPROPERTY(info) (((info) & TERRAIN_MASK) == CT || ((info) & TERRAIN_MASK) == BS)
+
+struct Unit {
+	unsigned char isUnit, player, hp, moved;
+	unsigned char x, y;
+};
+
+struct Property {
+	unsigned char x, y;
+};
+
+struct Level {
+	unsigned char info[MAX_WIDTH][MAX_HEIGHT];
+	unsigned char unit[MAX_WIDTH][MAX_HEIGHT];
+	struct Unit units[MAX_UNITS];
+	unsigned char unitNext[MAX_UNITS];
+	unsigned char unitFirstEmpty, unitFirstOwned[2];
+	struct Property properties[2][MAX_PROPERTIES];
+	unsigned int propertyCount[2];
+	unsigned int credits[2];
+	unsigned char activePlayer;
+	unsigned long visits;
+};
+
+static int width, height;
+static unsigned long rngState;
+
+static unsigned int rnd(unsigned int n) {
+	rngState = rngState * 6364136223846793005UL + 1442695040888963407UL;
+	return (rngState >> 33) % n;
+}
+
+static void setPropertyOwner(struct Level* l, int x, int y, unsigned char player) {
+	unsigned char owner = l->info[x][y] & OWNER_MASK;
+	unsigned int p, i;
+
+	if(ISPROPERTY(l->info[x][y]) && owner != NEU) {
+		p = PLINDEX(owner);
+		for(i = 0; l->properties[p][i].x != x || l->properties[p][i].y != y; i++);
+		l->properties[p][i] = l->properties[p][--l->propertyCount[p]];
+	}
+	l->info[x][y] = (l->info[x][y] & TERRAIN_MASK) | player;
+	if(ISPROPERTY(l->info[x][y]) && player != NEU) {
+		p = PLINDEX(player);
+		l->properties[p][l->propertyCount[p]].x = x;
+		l->properties[p][l->propertyCount[p]].y = y;
+		l->propertyCount[p]++;
+	}
+}
+
+static void addUnit(struct Level* l, int x, int y, unsigned char player) {
+	unsigned char u = l->unitFirstEmpty;
+
+	if(u == 0xFF || l->unit[x][y] != 0xFF)
+		return;
+	l->unitFirstEmpty = l->unitNext[u];
+	l->unitNext[u] = l->unitFirstOwned[PLINDEX(player)];
+	l->unitFirstOwned[PLINDEX(player)] = u;
+	l->units[u].isUnit = 1;
+	l->units[u].player = player;
+	l->units[u].hp = 50;
+	l->units[u].moved = 1;
+	l->units[u].x = x;
+	l->units[u].y = y;
+	l->unit[x][y] = u;
+}
+
+static void removeUnit(struct Level* l, unsigned char u) {
+	unsigned char* link = &l->unitFirstOwned[PLINDEX(l->units[u].player)];
+
+	while(*link != u)
+		link = &l->unitNext[*link];
+	*link = l->unitNext[u];
+	l->units[u].isUnit = 0;
+	l->unit[l->units[u].x][l->units[u].y] = 0xFF;
+	l->unitNext[u] = l->unitFirstEmpty;
+	l->unitFirstEmpty = u;
+}
+
+static void generate(struct Level* l, int propertyPercent, int unitsPerPlayer) {
+	static const unsigned char owners[] = {NEU, NEU, PL1, PL2};
+	int x, y, i;
+
+	memset(l, 0, sizeof(*l));
+	memset(l->unit, 0xFF, sizeof(l->unit));
+	for(i = 0; i < MAX_UNITS; i++)
+		l->unitNext[i] = i + 1 < MAX_UNITS ? i + 1 : 0xFF;
+	l->unitFirstOwned[0] = l->unitFirstOwned[1] = 0xFF;
+	l->activePlayer = PL1;
+
+	for(x = 0; x < width; x++) {
+		for(y = 0; y < height; y++) {
+			l->info[x][y] = (int)rnd(100) < propertyPercent ? CT + rnd(2) : PL + rnd(3);
+			setPropertyOwner(l, x, y, owners[rnd(4)]);
+		}
+	}
+	for(i = 0; i < 2 * unitsPerPlayer; i++)
+		addUnit(l, rnd(width), rnd(height), i & 1 ? PL2 : PL1);
+}
+
+// what the player about to start does before ending the turn
+static void play(struct Level* l) {
+	unsigned char player = l->activePlayer == PL1 ? PL2 : PL1;
+	unsigned char u, next;
+	int x, y;
+
+	for(u = l->unitFirstOwned[PLINDEX(player)]; u != 0xFF; u = next) {
+		next = l->unitNext[u];
+		if(rnd(40) == 0) {
+			removeUnit(l, u);
+			continue;
+		}
+		x = rnd(width);
+		y = rnd(height);
+		if(rnd(2) && l->unit[x][y] == 0xFF) {
+			l->unit[l->units[u].x][l->units[u].y] = 0xFF;
+			l->units[u].x = x;
+			l->units[u].y = y;
+			l->unit[x][y] = u;
+		}
+		if(ISPROPERTY(l->info[l->units[u].x][l->units[u].y]))
+			l->info[l->units[u].x][l->units[u].y] |= HASPROD_MASK;
+	}
+	if(rnd(2) == 0)
+		addUnit(l, rnd(width), rnd(height), player);
+}
+
+static void turnUnit(struct Level* l, struct Unit* unit) {
+	unsigned char* info = &l->info[unit->x][unit->y];
+
+	unit->moved = 0;
+	if((*info & OWNER_MASK) == l->activePlayer && ISPROPERTY(*info)) {
+		unit->hp += 20;
+		if(unit->hp > 100)
+			unit->hp = 100;
+	}
+	else if(ISPROPERTY(*info)) {
+		setPropertyOwner(l, unit->x, unit->y, l->activePlayer);
+	}
+}
+
+static void finishCredits(struct Level* l, unsigned int p) {
+	if(l->credits[p] > 200)
+		l->credits[p] = 200;
+}
+
+// the old endTurn: every unit slot, then every square of the map
+static void scanTurn(struct Level* l) {
+	unsigned int p, i;
+	int x, y;
+
+	l->activePlayer = l->activePlayer == PL1 ? PL2 : PL1;
+	p = PLINDEX(l->activePlayer);
+	for(i = 0; i < MAX_UNITS; i++) {
+		l->visits++;
+		if(l->units[i].isUnit && l->units[i].player == l->activePlayer)
+			turnUnit(l, &l->units[i]);
+	}
+	l->credits[p] += 4;
+	for(x = 0; x < width; x++) {
+		for(y = 0; y < height; y++) {
+			l->visits++;
+			if((l->info[x][y] & OWNER_MASK) == l->activePlayer && ISPROPERTY(l->info[x][y])) {
+				l->info[x][y] &= ~HASPROD_MASK;
+				l->credits[p] += 4;
+			}
+		}
+	}
+	finishCredits(l, p);
+}
+
+// endTurn now: the player's unit list, then its property list
+static void listTurn(struct Level* l) {
+	unsigned int p, i;
+	unsigned char u;
+
+	l->activePlayer = l->activePlayer == PL1 ? PL2 : PL1;
+	p = PLINDEX(l->activePlayer);
+	for(u = l->unitFirstOwned[p]; u != 0xFF; u = l->unitNext[u]) {
+		l->visits++;
+		turnUnit(l, &l->units[u]);
+	}
+	l->credits[p] += 4 + 4 * l->propertyCount[p];
+	for(i = 0; i < l->propertyCount[p]; i++) {
+		l->visits++;
+		l->info[l->properties[p][i].x][l->properties[p][i].y] &= ~HASPROD_MASK;
+	}
+	finishCredits(l, p);
+}
+
+static double seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(int turns, int propertyPercent, int unitsPerPlayer) {
+	static struct Level scan, list;
+	double scanTime = 0, listTime = 0, start;
+	unsigned long seed = width * 1000 + height;
+	unsigned int units;
+	int t;
+
+	rngState = seed;
+	generate(&scan, propertyPercent, unitsPerPlayer);
+	list = scan;
+
+	for(t = 0; t < turns; t++) {
+		rngState = seed + t;
+		play(&scan);
+		rngState = seed + t;
+		play(&list);
+
+		start = seconds();
+		scanTurn(&scan);
+		scanTime += seconds() - start;
+		start = seconds();
+		listTurn(&list);
+		listTime += seconds() - start;
+
+		if(memcmp(scan.info, list.info, sizeof(scan.info)) != 0 || memcmp(scan.credits, list.credits, sizeof(scan.credits)) != 0 ||
+				memcmp(scan.units, list.units, sizeof(scan.units)) != 0) {
+			fprintf(stderr, "econbench: %dx%d differs after turn %d\n", width, height, t);
+			return 1;
+		}
+	}
+
+	for(t = 0, units = 0; t < MAX_UNITS; t++)
+		units += list.units[t].isUnit;
+	printf("%5dx%-3d %6u %6u %10.1f %10.1f %9.0f %9.0f %6.1fx\n", width, height,
+			list.propertyCount[0] + list.propertyCount[1], units,
+			(double)scan.visits / turns, (double)list.visits / turns,
+			scanTime / turns * 1e9, listTime / turns * 1e9, listTime > 0 ? scanTime / listTime : 0);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	static const char* defaultSizes[] = {"16x11", "30x11", "32x32", "64x64"};
+	const char** sizes = defaultSizes;
+	int sizeCount = 4, turns = 10000, propertyPercent = 5, unitsPerPlayer = 20, argi = 1, i;
+
+	for(; argi < argc && argv[argi][0] == '-'; argi++) {
+		if(strcmp(argv[argi], "-n") == 0 && argi+1 < argc)
+			turns = atoi(argv[++argi]);
+		else if(strcmp(argv[argi], "-p") == 0 && argi+1 < argc)
+			propertyPercent = atoi(argv[++argi]);
+		else if(strcmp(argv[argi], "-u") == 0 && argi+1 < argc)
+			unitsPerPlayer = atoi(argv[++argi]);
+		else
+			break;
+	}
+	if((argi < argc && argv[argi][0] == '-') || turns <= 0 || unitsPerPlayer * 2 > MAX_UNITS) {
+		fprintf(stderr, "usage: econbench [-n turns] [-p property %%] [-u units per player] [WxH...]\n");
+		return 1;
+	}
+	if(argi < argc) {
+		sizes = (const char**)argv + argi;
+		sizeCount = argc - argi;
+	}
+
+	printf("     map  owned  units  scan/turn  list/turn   scan ns   list ns  speedup\n");
+	for(i = 0; i < sizeCount; i++) {
+		if(sscanf(sizes[i], "%dx%d", &width, &height) != 2 || width < 1 || height < 1 ||
+				width > MAX_WIDTH || height > MAX_HEIGHT) {
+			fprintf(stderr, "econbench: bad map size %s, at most %dx%d\n", sizes[i], MAX_WIDTH, MAX_HEIGHT);
+			return 1;
+		}
+		if(run(turns, propertyPercent, unitsPerPlayer))
+			return 1;
+	}
+	return 0;
+}
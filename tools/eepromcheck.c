@@ -0,0 +1,246 @@
+/*
+ * Check of the RAM directory of the EEPROM blocks (EEPROM_DIRECTORY=1 in
+ * kernel/uzeboxCore.c), built from the kernel sources against the
+ * emulated EEPROM of tools/host/core.c.
+ *
+ * The directory must give the same answers as reading every block
+ * header. Each image (EEPROM dumps like default/eeprom.bin, and random
+ * ones with many ids sharing a hash slot) is loaded as at power on and
+ * every block id is looked up. Then random operations run on it: block
+ * writes, queued writes, restarts, and formats keeping some blocks.
+ * After each one the blocks are looked up again, no id may be in two
+ * blocks, the EEPROM may only be full when no block is free and the
+ * blocks written hold what was last written to them until a format.
+ *
+ * Build from default/ with make eepromcheck, then:
+ *   ./eepromcheck [-r random images] [-n operations] [image.bin...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uzebox.h"
+#include "core.h"
+
+#define POOL_SIZE 80
+
+static unsigned int pool[POOL_SIZE];
+
+// what each id of the pool should hold
+static struct EepromBlockStruct model[POOL_SIZE];
+static char present[POOL_SIZE];
+static unsigned long rngState = 1;
+
+static unsigned int rnd(unsigned int n) {
+	rngState = rngState * 6364136223846793005UL + 1442695040888963407UL;
+	return (rngState >> 33) % n;
+}
+
+static unsigned int headerId(int b) {
+	return hostEeprom[b * EEPROM_BLOCK_SIZE] + (hostEeprom[b * EEPROM_BLOCK_SIZE + 1] << 8);
+}
+
+// the lookup without the directory, the first block with that id or 0
+static int scanFind(unsigned int id) {
+	int b;
+	for(b = EEPROM_HEADER_SIZE; b < EEPROM_BLOCKS_COUNT; b++) {
+		if(headerId(b) == id)
+			return b;
+	}
+	return 0;
+}
+
+static int formatted(void) {
+	return headerId(0) == EEPROM_SIGNATURE;
+}
+
+// half the ids share one directory slot, the others are anywhere
+static void makePool(void) {
+	unsigned int id, hi, i, j;
+
+	for(i = 0; i < POOL_SIZE; i++) {
+		do {
+			if(i < POOL_SIZE / 2) {
+				hi = rnd(256);
+				id = (hi << 8) | ((hi ^ 5) & (EEPROM_DIR_SIZE - 1)) | (rnd(256) & ~(EEPROM_DIR_SIZE - 1) & 0xff);
+			}
+			else {
+				id = rnd(0x10000);
+			}
+			for(j = 0; j < i && pool[j] != id; j++);
+		} while(j < i || id == EEPROM_FREE_BLOCK || id == EEPROM_SIGNATURE);
+		pool[i] = id;
+	}
+}
+
+static void randomImage(void) {
+	int n, b, i;
+
+	hostEepromLoad(NULL);
+	FormatEeprom();
+	for(n = rnd(EEPROM_BLOCKS_COUNT); n > 0; n--) {
+		b = EEPROM_HEADER_SIZE + rnd(EEPROM_BLOCKS_COUNT - EEPROM_HEADER_SIZE);
+		do {
+			i = rnd(POOL_SIZE);
+		} while(scanFind(pool[i]) != 0);
+		hostEeprom[b * EEPROM_BLOCK_SIZE] = pool[i] & 0xff;
+		hostEeprom[b * EEPROM_BLOCK_SIZE + 1] = pool[i] >> 8;
+		for(i = 2; i < EEPROM_BLOCK_SIZE; i++)
+			hostEeprom[b * EEPROM_BLOCK_SIZE + i] = rnd(256);
+	}
+}
+
+// the kernel's answer for an id against the block headers
+static int lookup(const char* name, const char* when, unsigned int id) {
+	struct EepromBlockStruct block;
+	char ret = EepromReadBlock(id, &block);
+	int b = scanFind(id);
+
+	if(!formatted()) {
+		if(ret == EEPROM_ERROR_NOT_FORMATTED)
+			return 0;
+	}
+	else if(b == 0) {
+		if(ret == EEPROM_ERROR_BLOCK_NOT_FOUND)
+			return 0;
+	}
+	else if(ret == 0 && memcmp(&block, &hostEeprom[b * EEPROM_BLOCK_SIZE], EEPROM_BLOCK_SIZE) == 0) {
+		return 0;
+	}
+	fprintf(stderr, "eepromcheck: %s, %s: id %04x is in block %d, the kernel returned %d\n", name, when, id, b, ret);
+	return 1;
+}
+
+// every id, and what the directory saves in EEPROM reads
+static int lookupAll(const char* name) {
+	unsigned long directory = 0, scan = 0, reads, found = 0;
+	unsigned int id;
+	int b;
+
+	for(id = 0; id < EEPROM_FREE_BLOCK; id++) {
+		reads = hostEepromReads;
+		if(lookup(name, "at power on", id))
+			return 1;
+		directory += hostEepromReads - reads;
+
+		b = scanFind(id);
+		scan += 2 + 2 * ((b ? b : EEPROM_BLOCKS_COUNT) - EEPROM_HEADER_SIZE) + (b ? EEPROM_BLOCK_SIZE : 0);
+		found += b != 0;
+	}
+	printf("%s: %lu ids found, %.1f EEPROM reads per lookup (%.1f reading every header), ",
+			name, found, (double)directory / EEPROM_FREE_BLOCK, (double)scan / EEPROM_FREE_BLOCK);
+	return 0;
+}
+
+static int operate(const char* name, int operations) {
+	struct EepromBlockStruct block;
+	u16 keep[POOL_SIZE];
+	char when[64], ret;
+	int op, i, b, n, full;
+
+	for(i = 0; i < POOL_SIZE; i++) {
+		b = formatted() ? scanFind(pool[i]) : 0;
+		present[i] = b != 0;
+		memcpy(&model[i], &hostEeprom[b * EEPROM_BLOCK_SIZE], EEPROM_BLOCK_SIZE);
+	}
+
+	for(op = 0; op < operations; op++) {
+		i = rnd(100);
+		snprintf(when, sizeof(when), "operation %d", op);
+		if(i < 80) {
+			i = rnd(POOL_SIZE);
+			block.id = pool[i];
+			for(n = 0; n < (int)sizeof(block.data); n++)
+				block.data[n] = rnd(256);
+			full = formatted() && scanFind(block.id) == 0 && scanFind(EEPROM_FREE_BLOCK) == 0;
+			if(i < 50) {
+				ret = EepromWriteBlock(&block);
+			}
+			else {
+				ret = EepromWriteBlockAsync(&block);
+				hostEepromDrain();
+			}
+			if(ret != (!formatted() ? EEPROM_ERROR_NOT_FORMATTED : full ? EEPROM_ERROR_FULL : 0) ||
+					(ret == 0 && memcmp(&block, &hostEeprom[scanFind(block.id) * EEPROM_BLOCK_SIZE], EEPROM_BLOCK_SIZE) != 0)) {
+				fprintf(stderr, "eepromcheck: %s, %s: writing id %04x returned %d\n", name, when, block.id, ret);
+				return 1;
+			}
+			if(ret == 0) {
+				present[i] = 1;
+				model[i] = block;
+			}
+		}
+		else if(i < 90) {
+			hostPowerOn();
+		}
+		else if(i < 99) {
+			for(n = 0, b = 0; b < POOL_SIZE; b++) {
+				if(rnd(2))
+					keep[n++] = pool[b];
+				else
+					present[b] = 0;
+			}
+			FormatEeprom2(keep, n);
+		}
+		else {
+			FormatEeprom();
+			memset(present, 0, sizeof(present));
+		}
+
+		for(b = EEPROM_HEADER_SIZE; b < EEPROM_BLOCKS_COUNT; b++) {
+			if(headerId(b) != EEPROM_FREE_BLOCK && scanFind(headerId(b)) != b) {
+				fprintf(stderr, "eepromcheck: %s, %s: id %04x is in two blocks\n", name, when, headerId(b));
+				return 1;
+			}
+		}
+		for(i = 0; i < POOL_SIZE; i++) {
+			if(lookup(name, when, pool[i]))
+				return 1;
+			b = scanFind(pool[i]);
+			if(formatted() && (present[i] != (b != 0) ||
+					(b != 0 && memcmp(&model[i], &hostEeprom[b * EEPROM_BLOCK_SIZE], EEPROM_BLOCK_SIZE) != 0))) {
+				fprintf(stderr, "eepromcheck: %s, %s: id %04x lost what was written to it\n", name, when, pool[i]);
+				return 1;
+			}
+		}
+	}
+	printf("%d operations\n", operations);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	int images = 100, operations = 2000, argi = 1, i;
+	char name[32];
+
+	for(; argi < argc && argv[argi][0] == '-'; argi++) {
+		if(strcmp(argv[argi], "-r") == 0 && argi+1 < argc)
+			images = atoi(argv[++argi]);
+		else if(strcmp(argv[argi], "-n") == 0 && argi+1 < argc)
+			operations = atoi(argv[++argi]);
+		else
+			break;
+	}
+	if((argi < argc && argv[argi][0] == '-') || images < 0 || operations < 0) {
+		fprintf(stderr, "usage: eepromcheck [-r random images] [-n operations] [image.bin...]\n");
+		return 1;
+	}
+
+	makePool();
+	for(; argi < argc; argi++) {
+		if(!hostEepromLoad(argv[argi])) {
+			fprintf(stderr, "eepromcheck: can't read %s\n", argv[argi]);
+			return 1;
+		}
+		hostPowerOn();
+		if(lookupAll(argv[argi]) || operate(argv[argi], operations))
+			return 1;
+	}
+	for(i = 0; i < images; i++) {
+		snprintf(name, sizeof(name), "random image %d", i);
+		randomImage();
+		hostPowerOn();
+		if(lookupAll(name) || operate(name, operations))
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * File loading benchmark, runs kernel/petitfatfs on the host against a
+ * disk image through the SD card simulator of tools/host/sdcard.c.
+ *
+ * The files are opened and read in chunks like the game loads its levels
+ * and assets, the whole list is loaded as many times as asked. It prints
+ * the commands sent to the card, the SPI bytes exchanged, an estimate of
+ * the time that takes on the console, and the cache statistics of
+ * pf_getstats. The image must hold a FAT16 file system.
+ *
+ * Build from default/ with "make fsbench" (directory cache and read-ahead
+ * on) or "make fsbench-nocache" (both off) to compare them.
+ *
+ * Usage:
+ *   ./fsbench [-l latency] [-b chunk] [-n passes] disk.img file...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "petitfatfs/pff.h"
+#include "petitfatfs/diskio.h"
+#include "sdcard.h"
+
+#define CPU_HZ 28636360UL
+#define CYCLES_PER_BYTE 20 // rcv_spi at full SPI speed
+#define MAX_CHUNK 512
+
+int main(int argc, char** argv) {
+	static unsigned char buf[MAX_CHUNK];
+	unsigned long total = 0, ms;
+	int latency = 100, chunk = 32, passes = 2, argi = 1, pass, i;
+	FATFS fs;
+	PFSTAT st;
+	FRESULT res;
+	WORD br;
+
+	for(; argi < argc && argv[argi][0] == '-'; argi++) {
+		if(strcmp(argv[argi], "-l") == 0 && argi+1 < argc)
+			latency = atoi(argv[++argi]);
+		else if(strcmp(argv[argi], "-b") == 0 && argi+1 < argc)
+			chunk = atoi(argv[++argi]);
+		else if(strcmp(argv[argi], "-n") == 0 && argi+1 < argc)
+			passes = atoi(argv[++argi]);
+		else
+			break;
+	}
+	if(argc - argi < 2 || chunk < 1 || chunk > MAX_CHUNK || latency < 0 || latency > 400) {
+		fprintf(stderr, "usage: fsbench [-l latency] [-b chunk] [-n passes] disk.img file...\n");
+		return 1;
+	}
+
+	sdOpen(argv[argi++], latency);
+	res = pf_mount(&fs);
+	if(res != FR_OK) {
+		fprintf(stderr, "fsbench: can't mount the image (%d)\n", res);
+		return 1;
+	}
+
+	for(pass = 0; pass < passes; pass++) {
+		for(i = argi; i < argc; i++) {
+			res = pf_open(argv[i]);
+			if(res != FR_OK) {
+				fprintf(stderr, "fsbench: can't open %s (%d)\n", argv[i], res);
+				return 1;
+			}
+			do {
+				res = pf_read(buf, chunk, &br);
+				total += br;
+			} while(res == FR_OK && br == chunk);
+			if(res != FR_OK) {
+				fprintf(stderr, "fsbench: can't read %s (%d)\n", argv[i], res);
+				return 1;
+			}
+		}
+	}
+	disk_stop();
+	pf_getstats(&st);
+
+	ms = (unsigned long)((double)sdStats.spiBytes * CYCLES_PER_BYTE * 1000 / CPU_HZ + sdStats.waitUs / 1000);
+	printf("%lu bytes from %d files, %d passes, %d byte chunks, %d bytes latency\n",
+			total, argc - argi, passes, chunk, latency);
+	printf("commands     CMD17 %lu, CMD18 %lu, CMD12 %lu\n",
+			sdStats.commands[17], sdStats.commands[18], sdStats.commands[12]);
+	printf("spi bytes    %lu, about %lu ms\n", sdStats.spiBytes, ms);
+	printf("directory    %u hits, %u misses\n", st.dir_hits, st.dir_misses);
+	printf("reads        %u hits, %u misses\n", st.rd_hits, st.rd_misses);
+	return 0;
+}
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for <avr/interrupt.h>, interrupts are plain functions
+ * that the host tools call themselves
+ */
+#pragma once
+
+#define sei()
+#define cli()
+#define ISR(vector, ...) void vector(void)
@@ -0,0 +1,108 @@
+/*
+ * Host stand-in for <avr/io.h>, only what the kernel sound engine needs
+ * to build for tools/sndrender.c, what kernel/petitfatfs/mmc.c needs
+ * to build for tools/fsbench.c and what kernel/uzeboxCore.c needs to
+ * build for the kernel checks (tools/host/core.c)
+ */
+#pragma once
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+// TIMER1, used by SOUND_ENGINE_PROFILE
+extern volatile uint16_t TCNT1;
+
+// SPI and the SD card pins, the card is simulated by tools/host/sdcard.c
+extern volatile uint8_t SPDR, SPSR, SPCR, PORTB, PORTD, DDRB, DDRD;
+#define SPR0 0
+#define SPR1 1
+#define MSTR 4
+#define SPE 6
+#define SPIF 7
+#define PORTB5 5
+#define PORTB7 7
+#define PORTD6 6
+
+// the byte in SPDR is exchanged with the card while waiting for SPIF
+void sdTransfer(void);
+#define loop_until_bit_is_set(sfr, bit) sdTransfer()
+
+// the rest of uzeboxCore.c's registers are plain memory, nothing drives them
+extern volatile uint8_t hostIo[0x100];
+#define _SFR_MEM_ADDR(reg) 0 // only for the io_table of Initialize, which isn't run
+#define _SFR_IO_ADDR(reg) 0
+#define SP (*(volatile uint16_t*)&hostIo[0x5d])
+#define MCUSR hostIo[0x54]
+#define EECR hostIo[0x3f]
+#define PINA hostIo[0x20]
+#define DDRA hostIo[0x21]
+#define PORTA hostIo[0x22]
+#define DDRC hostIo[0x27]
+#define PORTC hostIo[0x28]
+#define PIND hostIo[0x29]
+#define TCCR0A hostIo[0x44]
+#define TCCR0B hostIo[0x45]
+#define OCR0A hostIo[0x47]
+#define TIMSK1 hostIo[0x6f]
+#define TCCR1B hostIo[0x81]
+#define TCNT1L hostIo[0x84]
+#define TCNT1H hostIo[0x85]
+#define OCR1AL hostIo[0x88]
+#define OCR1AH hostIo[0x89]
+#define OCR1BL hostIo[0x8a]
+#define OCR1BH hostIo[0x8b]
+#define TCCR2A hostIo[0xb0]
+#define TCCR2B hostIo[0xb1]
+#define OCR2A hostIo[0xb3]
+#define UCSR0A hostIo[0xc0]
+#define UCSR0B hostIo[0xc1]
+#define UCSR0C hostIo[0xc2]
+#define UBRR0L hostIo[0xc4]
+#define UBRR0H hostIo[0xc5]
+
+#define EEPE 1
+#define WGM01 1
+#define COM0A0 6
+#define CS00 0
+#define OCIE1A 1
+#define WGM12 3
+#define CS10 0
+#define WGM20 0
+#define WGM21 1
+#define COM2A1 7
+#define CS20 0
+#define U2X0 1
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ00 1
+#define UCSZ01 2
+
+#define PORTA0 0
+#define PORTA1 1
+#define PORTA2 2
+#define PORTA3 3
+#define PORTA4 4
+#define PORTA5 5
+#define PORTA6 6
+#define PORTA7 7
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTB3 3
+#define PORTB4 4
+#define PORTB6 6
+#define PORTC0 0
+#define PORTC1 1
+#define PORTC2 2
+#define PORTC3 3
+#define PORTC4 4
+#define PORTC5 5
+#define PORTC6 6
+#define PORTC7 7
+#define PORTD0 0
+#define PORTD1 1
+#define PORTD2 2
+#define PORTD3 3
+#define PORTD4 4
+#define PORTD5 5
+#define PORTD7 7
@@ -0,0 +1,17 @@
+/*
+ * Host stand-in for <avr/pgmspace.h>, flash is plain memory on the host.
+ * pgm_read_word is also used to read pointers from flash tables, so it
+ * reads a whole pointer when given one.
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (sizeof(*(p)) == sizeof(void*) ? (uintptr_t)*(void* const*)(p) : (uintptr_t)*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define strlen_P strlen
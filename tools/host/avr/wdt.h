@@ -0,0 +1,8 @@
+/*
+ * Host stand-in for <avr/wdt.h>, there is no watchdog
+ */
+#pragma once
+
+#define wdt_disable()
+#define wdt_enable(timeout)
+#define WDTO_15MS 0
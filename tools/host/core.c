@@ -0,0 +1,120 @@
+/*
+ * Stand-ins for what kernel/uzeboxCore.c links against on the console:
+ * the EEPROM access routines, the registers and the variables owned by
+ * the assembler parts of the kernel (video mode, mixer, sync).
+ *
+ * The EEPROM is a plain array that also counts the writes to each byte,
+ * and can lose power on a chosen write to check what a reset leaves
+ * behind. Nothing runs in the background, the checks call the VSYNC work
+ * (ProcessEepromQueue) and the UART slot of the mixer (hostUartLine)
+ * themselves.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "uzebox.h"
+#include "core.h"
+
+unsigned char hostEeprom[HOST_EEPROM_SIZE];
+unsigned long hostEepromWear[HOST_EEPROM_SIZE];
+unsigned long hostEepromReads;
+unsigned long hostEepromWrites;
+long hostPowerCut = -1;
+jmp_buf hostPowerOff;
+
+volatile uint8_t hostIo[0x100];
+
+// owned by the assembler parts of the kernel
+unsigned char sync_phase, sync_pulse, sync_flags;
+volatile unsigned int joypad1_status_lo, joypad2_status_lo;
+volatile unsigned int joypad1_status_hi, joypad2_status_hi;
+unsigned char render_lines_count, render_lines_count_tmp;
+unsigned char first_render_line, first_render_line_tmp;
+unsigned char sound_enabled;
+unsigned char tr4_barrel_hi, tr4_barrel_lo, tr4_params;
+struct MixerStruct mixer;
+u8 __bss_end;
+
+void DisplayLogo() {}
+void InitializeVideoMode() {}
+
+#if EEPROM_WRITE_QUEUE == 1
+	extern volatile u8 eeprom_queue_head, eeprom_queue_count, eeprom_queue_hold;
+	void ProcessEepromQueue(void);
+#endif
+
+#if UART_RX_BUFFER == 1
+	extern u8 uart_rx_buf_start, uart_rx_buf_end, uart_rx_buf[], uart_rx_overflows;
+#endif
+#if UART_TX_BUFFER == 1
+	extern u8 uart_tx_buf_start, uart_tx_buf_end, uart_tx_buf[];
+#endif
+
+unsigned char ReadEeprom(unsigned int addr) {
+	hostEepromReads++;
+	return hostEeprom[addr % HOST_EEPROM_SIZE];
+}
+
+void WriteEeprom(unsigned int addr, unsigned char value) {
+	if(hostPowerCut >= 0 && hostEepromWrites == (unsigned long)hostPowerCut)
+		longjmp(hostPowerOff, 1);
+	hostEeprom[addr % HOST_EEPROM_SIZE] = value;
+	hostEepromWear[addr % HOST_EEPROM_SIZE]++;
+	hostEepromWrites++;
+}
+
+int hostEepromLoad(const char* path) {
+	FILE* f;
+
+	memset(hostEeprom, 0xff, sizeof(hostEeprom));
+	memset(hostEepromWear, 0, sizeof(hostEepromWear));
+	hostEepromWrites = hostEepromReads = 0;
+	if(path == NULL)
+		return 1;
+	if((f = fopen(path, "rb")) == NULL)
+		return 0;
+	fread(hostEeprom, 1, sizeof(hostEeprom), f);
+	fclose(f);
+	return 1;
+}
+
+void hostPowerOn(void) {
+	#if EEPROM_WRITE_QUEUE == 1
+		eeprom_queue_head = eeprom_queue_count = eeprom_queue_hold = 0;
+	#endif
+	#if EEPROM_DIRECTORY == 1
+		EepromDirLoad();
+	#endif
+}
+
+void hostEepromDrain(void) {
+	#if EEPROM_WRITE_QUEUE == 1
+		while(EepromWritePending())
+			ProcessEepromQueue();
+	#endif
+}
+
+int hostUartLine(int received, int ready) {
+	int sent = -1;
+	u8 next;
+
+	#if UART_RX_BUFFER == 1
+		if(received >= 0) {
+			next = (uart_rx_buf_end + 1) & (UART_RX_BUFFER_SIZE - 1);
+			if(next == uart_rx_buf_start) {
+				uart_rx_overflows++;
+			}
+			else {
+				uart_rx_buf[uart_rx_buf_end] = received;
+				uart_rx_buf_end = next;
+			}
+		}
+	#endif
+	#if UART_TX_BUFFER == 1
+		if(ready && uart_tx_buf_start != uart_tx_buf_end) {
+			sent = uart_tx_buf[uart_tx_buf_start];
+			uart_tx_buf_start = (uart_tx_buf_start + 1) & (UART_TX_BUFFER_SIZE - 1);
+		}
+	#endif
+	return sent;
+}
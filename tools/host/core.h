@@ -0,0 +1,38 @@
+/*
+ * EEPROM and register stand-ins for host builds of kernel/uzeboxCore.c,
+ * see core.c
+ */
+#pragma once
+#include <setjmp.h>
+
+#define HOST_EEPROM_SIZE 2048
+
+// the EEPROM contents, how many times each byte was written and the
+// ReadEeprom calls so far
+extern unsigned char hostEeprom[HOST_EEPROM_SIZE];
+extern unsigned long hostEepromWear[HOST_EEPROM_SIZE];
+extern unsigned long hostEepromReads;
+
+// WriteEeprom calls so far, the power goes off on the call numbered
+// hostPowerCut (before that byte is written) and longjmps to hostPowerOff
+extern unsigned long hostEepromWrites;
+extern long hostPowerCut;
+extern jmp_buf hostPowerOff;
+
+// fills the EEPROM from an image, blank (0xff) when path is NULL or the
+// file is shorter, returns 0 if the file can't be read
+int hostEepromLoad(const char* path);
+
+// what the kernel does at power on: the RAM state of the EEPROM code is
+// lost, the directory is rebuilt from the EEPROM and the write queue is empty
+void hostPowerOn(void);
+
+// writes the queued EEPROM bytes like the VSYNC handler would, one per call
+// of ProcessEepromQueue, until the queue is empty
+void hostEepromDrain(void);
+
+// one scanline of the UART slot of the mixer (soundMixerInline.s): stores
+// the received byte (-1 for none) or counts an overflow if the RX buffer is
+// full, and when ready sends the next byte of the TX buffer, returned (-1
+// for none)
+int hostUartLine(int received, int ready);
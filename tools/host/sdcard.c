@@ -0,0 +1,176 @@
+/*
+ * SD card simulator, answers the SPI transfers of kernel/petitfatfs/mmc.c
+ * from a disk image so the file system code can run on the host.
+ *
+ * It models an SDHC card in SPI mode: CMD0, CMD8, CMD55/ACMD41, CMD58,
+ * CMD16, the single (CMD17) and multiple (CMD18) block reads and CMD12.
+ * Each read command waits the given latency before its first block, the
+ * following blocks of a multiple block read come without delay, like a
+ * real card reading ahead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include "sdcard.h"
+
+#define CS_PIN 6 // of PORTD, low selects the card
+
+volatile uint8_t SPDR, SPSR, SPCR, PORTB, PORTD, DDRB, DDRD;
+struct SdStats sdStats;
+
+static unsigned char* image;
+static unsigned long sectors;
+static int latency;
+
+static unsigned char cmd[6];
+static int cmdLen;
+static int appCmd, idle = 1;
+
+// bytes the card sends next, 0xFF when empty
+static unsigned char out[1024];
+static int outPos, outLen;
+
+// sector to send next of a multiple block read, -1 when none
+static long streamSect = -1;
+
+static void queue(unsigned char b) {
+	if(outLen == (int)sizeof(out)) {
+		fprintf(stderr, "sdcard: output overflow\n");
+		exit(1);
+	}
+	out[outLen++] = b;
+}
+
+// a data block: the wait, the token, the sector and a dummy CRC
+static void queueBlock(unsigned long sect, int wait) {
+	int i;
+	if(sect >= sectors) {
+		queue(0x09); // error token, out of range
+		return;
+	}
+	for(i = 0; i < wait; i++)
+		queue(0xFF);
+	queue(0xFE);
+	for(i = 0; i < 512; i++)
+		queue(image[sect * 512 + i]);
+	queue(0xFF);
+	queue(0xFF);
+}
+
+static void command(void) {
+	unsigned long arg = (unsigned long)cmd[1] << 24 | cmd[2] << 16 | cmd[3] << 8 | cmd[4];
+	int index = cmd[0] & 0x3F;
+
+	sdStats.commands[index]++;
+	if(index == 12) {
+		// the rest of the current block is dropped, a stuff byte comes first
+		outPos = outLen = 0;
+		streamSect = -1;
+		queue(0xFF);
+		queue(0x00);
+		queue(0x00); // busy
+		queue(0x00);
+		return;
+	}
+
+	outPos = outLen = 0;
+	streamSect = -1;
+	queue(0xFF); // response time
+	if(appCmd && index == 41) {
+		idle = 0;
+		queue(0x00);
+	}
+	else if(index == 0) {
+		idle = 1;
+		queue(0x01);
+	}
+	else if(index == 8) {
+		queue(0x01);
+		queue(0x00);
+		queue(0x00);
+		queue(cmd[3]);
+		queue(cmd[4]);
+	}
+	else if(index == 55) {
+		queue(idle);
+	}
+	else if(index == 58) {
+		queue(idle);
+		queue(0xC0); // powered up, CCS: block addressing
+		queue(0xFF);
+		queue(0x80);
+		queue(0x00);
+	}
+	else if(index == 16) {
+		queue(idle);
+	}
+	else if(index == 17 || index == 18) {
+		queue(idle ? 0x05 : 0x00);
+		if(!idle) {
+			queueBlock(arg, latency);
+			if(index == 18)
+				streamSect = arg + 1;
+		}
+	}
+	else {
+		queue(0x05); // illegal command
+	}
+	appCmd = index == 55;
+}
+
+void sdTransfer(void) {
+	unsigned char mosi = SPDR, miso = 0xFF;
+
+	sdStats.spiBytes++;
+	if(PORTD & (1 << CS_PIN)) {
+		SPDR = 0xFF;
+		return;
+	}
+
+	if(outPos == outLen && streamSect >= 0) {
+		outPos = outLen = 0;
+		queueBlock(streamSect++, 0);
+	}
+	if(outPos < outLen)
+		miso = out[outPos++];
+	if(outPos == outLen)
+		outPos = outLen = 0;
+
+	// a command starts with the bits 01
+	if(cmdLen || (mosi & 0xC0) == 0x40) {
+		cmd[cmdLen++] = mosi;
+		if(cmdLen == 6) {
+			cmdLen = 0;
+			command();
+		}
+	}
+	SPDR = miso;
+}
+
+void WaitUs(unsigned int delay) {
+	sdStats.waitUs += delay;
+}
+
+void sdOpen(const char* path, int readLatency) {
+	FILE* f = fopen(path, "rb");
+	long size;
+
+	if(!f) {
+		fprintf(stderr, "sdcard: can't open %s\n", path);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	image = malloc(size);
+	if(!image || fread(image, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "sdcard: can't read %s\n", path);
+		exit(1);
+	}
+	fclose(f);
+	sectors = size / 512;
+	latency = readLatency;
+	memset(&sdStats, 0, sizeof(sdStats));
+}
@@ -0,0 +1,17 @@
+/*
+ * SD card simulator for host builds of the kernel SD code, see sdcard.c
+ */
+#pragma once
+
+// commands received and bytes exchanged since sdOpen
+struct SdStats {
+	unsigned long commands[64];
+	unsigned long spiBytes;
+	unsigned long waitUs; // time spent in WaitUs
+};
+
+extern struct SdStats sdStats;
+
+// loads a disk image, latency is the number of busy bytes the card sends
+// before the first block of each read command
+void sdOpen(const char* path, int latency);
@@ -0,0 +1,11 @@
+/*
+ * Host stand-in for <util/crc16.h>, the same CRC-CCITT as avr-libc
+ */
+#pragma once
+#include <stdint.h>
+
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data) {
+	data ^= crc & 0xff;
+	data ^= data << 4;
+	return (((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3);
+}
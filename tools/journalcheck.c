@@ -0,0 +1,190 @@
+/*
+ * Power loss and wear check of the EEPROM journal (EepromJournalOpen and
+ * EepromJournalSave in kernel/uzeboxCore.c), built from the kernel
+ * sources against the emulated EEPROM of tools/host/core.c.
+ *
+ * A run of saves is repeated once per EEPROM write it does, with the
+ * power cut just before that write. After each cut the kernel starts
+ * again and the journal must open with the last save that finished
+ * writing, or the one that was being written, never an older one or
+ * none. One more save after the recovery must then be the one read
+ * back, so the recovery never leaves the newest record in the way.
+ * The run is done once with the journal opened a single time, and once
+ * with the kernel starting again before each save.
+ *
+ * It then saves many times from a blank EEPROM and prints the most
+ * written byte of each slot: the wear must be the same on all of them.
+ *
+ * Build from default/ with make journalcheck, then:
+ *   ./journalcheck [-s slots] [-n saves]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uzebox.h"
+#include "core.h"
+
+#define BASE_ID 0x4a00
+
+static int slots = 4;
+
+static void fill(unsigned char* data, int save) {
+	int j;
+	for(j = 0; j < EEPROM_JOURNAL_DATA_SIZE; j++)
+		data[j] = (save * 37 + j * 11 + (save >> 3)) & 0xff;
+}
+
+static void blank(void) {
+	hostEepromLoad(NULL);
+	FormatEeprom();
+	hostPowerOn();
+}
+
+// saves 0 to saves-1, *committed is the last one that finished writing
+// when a power cut longjmps out. With restart set the kernel starts again
+// and reopens the journal before each save, like one save per session.
+static void saveAll(struct EepromJournal* journal, int saves, int restart, volatile int* committed) {
+	unsigned char data[EEPROM_JOURNAL_DATA_SIZE];
+	int i;
+
+	for(i = 0; i < saves; i++) {
+		if(restart) {
+			hostPowerOn();
+			EepromJournalOpen(journal, BASE_ID, slots, data);
+		}
+		fill(data, i);
+		if(EepromJournalSave(journal, data) != 0) {
+			fprintf(stderr, "journalcheck: save %d failed\n", i);
+			exit(1);
+		}
+		hostEepromDrain();
+		*committed = i;
+	}
+}
+
+static int powerCuts(int saves, int restart) {
+	struct EepromJournal journal;
+	unsigned char data[EEPROM_JOURNAL_DATA_SIZE], expect[EEPROM_JOURNAL_DATA_SIZE], next[EEPROM_JOURNAL_DATA_SIZE];
+	volatile int committed;
+	unsigned long writes, cut, inFlight = 0;
+	char ret;
+
+	// how many writes the saves take without a power cut
+	blank();
+	EepromJournalOpen(&journal, BASE_ID, slots, data);
+	writes = hostEepromWrites;
+	saveAll(&journal, saves, restart, &committed);
+	writes = hostEepromWrites - writes;
+
+	for(cut = 0; cut < writes; cut++) {
+		blank();
+		EepromJournalOpen(&journal, BASE_ID, slots, data);
+		committed = -1;
+		hostPowerCut = hostEepromWrites + cut;
+		if(setjmp(hostPowerOff) == 0) {
+			saveAll(&journal, saves, restart, &committed);
+			fprintf(stderr, "journalcheck: write %lu was never reached\n", cut);
+			return 1;
+		}
+		hostPowerCut = -1;
+		hostPowerOn();
+
+		memset(data, 0, sizeof(data));
+		ret = EepromJournalOpen(&journal, BASE_ID, slots, data);
+		fill(expect, committed);
+		fill(next, committed + 1);
+		if(ret == 0 && memcmp(data, next, sizeof(data)) == 0) {
+			inFlight++;
+		}
+		else if(committed < 0 ? ret != EEPROM_ERROR_BLOCK_NOT_FOUND : ret != 0 || memcmp(data, expect, sizeof(data)) != 0) {
+			fprintf(stderr, "journalcheck: power cut at write %lu, during save %d: ", cut, committed + 1);
+			if(ret != 0)
+				fprintf(stderr, "error %d opening the journal\n", ret);
+			else
+				fprintf(stderr, "an older save came back\n");
+			return 1;
+		}
+
+		fill(next, 1000);
+		EepromJournalSave(&journal, next);
+		hostEepromDrain();
+		hostPowerOn();
+		if(EepromJournalOpen(&journal, BASE_ID, slots, data) != 0 || memcmp(data, next, sizeof(data)) != 0) {
+			fprintf(stderr, "journalcheck: power cut at write %lu, the save after the recovery was lost\n", cut);
+			return 1;
+		}
+	}
+
+	printf("%d saves over %d slots%s: power cut at each of the %lu writes, ", saves, slots, restart ? ", restarting before each" : "", writes);
+	printf("recovered the last finished save %lu times, the one being written %lu times\n", writes - inFlight, inFlight);
+	return 0;
+}
+
+// the block holding an id, 0 if none
+static int findBlock(unsigned int id) {
+	int b;
+	for(b = EEPROM_HEADER_SIZE; b < EEPROM_BLOCKS_COUNT; b++) {
+		if(hostEeprom[b * EEPROM_BLOCK_SIZE] + (hostEeprom[b * EEPROM_BLOCK_SIZE + 1] << 8) == id)
+			return b;
+	}
+	return 0;
+}
+
+static int wear(int saves) {
+	struct EepromJournal journal;
+	unsigned char data[EEPROM_JOURNAL_DATA_SIZE];
+	volatile int committed;
+	unsigned long most, least = ~0UL, slotMost[256];
+	int i, j, b;
+
+	blank();
+	EepromJournalOpen(&journal, BASE_ID, slots, data);
+	saveAll(&journal, saves, 0, &committed);
+
+	printf("\nwear after %d saves\nslot  block  most writes to a byte\n", saves);
+	for(i = 0, most = 0; i < slots; i++) {
+		if((b = findBlock(BASE_ID + i)) == 0) {
+			fprintf(stderr, "journalcheck: slot %d was never written\n", i);
+			return 1;
+		}
+		for(j = 0, slotMost[i] = 0; j < EEPROM_BLOCK_SIZE; j++) {
+			if(hostEepromWear[b * EEPROM_BLOCK_SIZE + j] > slotMost[i])
+				slotMost[i] = hostEepromWear[b * EEPROM_BLOCK_SIZE + j];
+		}
+		printf("%4d  %5d  %21lu\n", i, b, slotMost[i]);
+		if(slotMost[i] > most)
+			most = slotMost[i];
+		if(slotMost[i] < least)
+			least = slotMost[i];
+	}
+
+	// a save writes a byte at most once, plus claiming the block
+	if(most > (unsigned long)(saves + slots - 1) / slots + 1 || most - least > 2) {
+		fprintf(stderr, "journalcheck: the wear is not spread evenly over the slots\n");
+		return 1;
+	}
+	printf("a single block would have had %d writes\n", saves);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	int saves = 10000, argi = 1;
+
+	for(; argi < argc && argv[argi][0] == '-'; argi++) {
+		if(strcmp(argv[argi], "-s") == 0 && argi+1 < argc)
+			slots = atoi(argv[++argi]);
+		else if(strcmp(argv[argi], "-n") == 0 && argi+1 < argc)
+			saves = atoi(argv[++argi]);
+		else
+			break;
+	}
+	if(argi < argc || slots < 2 || slots > EEPROM_BLOCKS_COUNT - EEPROM_HEADER_SIZE || saves < 1) {
+		fprintf(stderr, "usage: journalcheck [-s slots] [-n saves]\n");
+		return 1;
+	}
+
+	if(powerCuts(3 * slots + 1, 0) || powerCuts(3 * slots + 1, 1) || wear(saves))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * RAM report, reads the linker map of the game and prints how the 4KB
+ * of RAM is shared between the kernel subsystems and the game, with the
+ * largest variables of each.
+ *
+ * The stack gets whatever is left above the last variable (__bss_end).
+ * The report fails with exit code 1 when that is less than the headroom
+ * given with -h, so the build stops before the stack can run into the
+ * variables. StackFree() (STACK_MONITOR=1) tells how much of it the game
+ * really uses, the telemetry reports it every frame.
+ *
+ * Build and run on the host:
+ *   gcc -o memmap memmap.c
+ *   ./memmap [-h headroom] [-n largest] uzeboxtactics.map
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RAM_END 0x1100 // one past the last byte
+#define DATA_OFFSET 0x800000 // data addresses in the map
+
+#define MAX_SYMBOLS 512
+#define NAME_SIZE 64
+
+enum {SEC_NOINIT, SEC_DATA, SEC_BSS, SECTIONS};
+static const char* sectionNames[] = {".noinit", ".data", ".bss"};
+
+// subsystem of each object file, first match wins
+static const struct {
+	const char* prefix;
+	const char* name;
+} subsystems[] = {
+	{"uzeboxVideoEngine", "video"},
+	{"videoMode", "video"},
+	{"uzeboxSoundEngine", "sound"},
+	{"soundMixer", "sound"},
+	{"uzeboxCore", "core"},
+	{"mmc", "sd card"},
+	{"tacticsCore", "game"},
+	{NULL, "libc"}
+};
+#define SUBSYSTEMS (int)(sizeof(subsystems) / sizeof(subsystems[0]))
+
+struct Symbol {
+	char name[NAME_SIZE];
+	unsigned long addr, size;
+	int subsystem;
+};
+
+static struct Symbol symbols[MAX_SYMBOLS];
+static int symbolCount;
+static unsigned long used[SUBSYSTEMS][SECTIONS];
+static unsigned long sectionStart[SECTIONS] = {RAM_END, RAM_END, RAM_END};
+static unsigned long sectionEnd[SECTIONS];
+static unsigned long bssEnd;
+
+static int findSubsystem(const char* object) {
+	const char* base = strrchr(object, '/');
+	int i;
+
+	base = base ? base + 1 : object;
+	for(i = 0; subsystems[i].prefix; i++) {
+		if(strncmp(base, subsystems[i].prefix, strlen(subsystems[i].prefix)) == 0)
+			return i;
+	}
+	return i;
+}
+
+// the symbols of an input section end where the next one starts
+static void closeSymbols(int first, unsigned long end) {
+	int i;
+	for(i = first; i < symbolCount; i++)
+		symbols[i].size = (i + 1 < symbolCount ? symbols[i + 1].addr : end) - symbols[i].addr;
+}
+
+static void parse(FILE* f) {
+	char line[512], name[256], pending[256] = "", object[256];
+	unsigned long addr, size, inputEnd = 0;
+	int section = -1, subsystem = 0, firstSymbol = 0, inMap = 0, n;
+
+	while(fgets(line, sizeof(line), f)) {
+		if(!inMap) {
+			inMap = strncmp(line, "Linker script and memory map", 28) == 0;
+			continue;
+		}
+
+		// output section, at column 0
+		if(line[0] == '.') {
+			closeSymbols(firstSymbol, inputEnd);
+			firstSymbol = symbolCount;
+			sscanf(line, "%255s", name);
+			for(section = 0; section < SECTIONS; section++) {
+				if(strcmp(name, sectionNames[section]) == 0)
+					break;
+			}
+			if(section == SECTIONS)
+				section = -1;
+			continue;
+		}
+		if(line[0] != ' ')
+			continue;
+
+		// end of the variables, the stack starts above
+		if(strstr(line, "__bss_end") && sscanf(line, " 0x%lx", &addr) == 1) {
+			bssEnd = addr - DATA_OFFSET;
+			continue;
+		}
+		if(section < 0)
+			continue;
+
+		// input section, its name is on a line of its own when too long
+		if(line[1] == '*') {
+			continue; // input patterns and fill
+		}
+		else if(line[1] != ' ') {
+			n = sscanf(line, " %255s 0x%lx 0x%lx %255s", name, &addr, &size, object);
+			if(n == 1) {
+				strcpy(pending, name);
+				continue;
+			}
+		}
+		else if(pending[0]) {
+			n = sscanf(line, " 0x%lx 0x%lx %255s", &addr, &size, object);
+			pending[0] = 0;
+			if(n != 3)
+				continue;
+			n = 4;
+		}
+		else {
+			// symbol inside the current input section
+			if(sscanf(line, " 0x%lx %255s", &addr, name) == 2 && strchr(name, '(') == NULL
+					&& strchr(name, '=') == NULL && symbolCount < MAX_SYMBOLS && addr - DATA_OFFSET < inputEnd) {
+				strncpy(symbols[symbolCount].name, name, NAME_SIZE - 1);
+				symbols[symbolCount].addr = addr - DATA_OFFSET;
+				symbols[symbolCount].subsystem = subsystem;
+				symbolCount++;
+			}
+			continue;
+		}
+		if(n != 4 || size == 0)
+			continue;
+
+		closeSymbols(firstSymbol, inputEnd);
+		firstSymbol = symbolCount;
+		subsystem = findSubsystem(object);
+		used[subsystem][section] += size;
+		inputEnd = addr - DATA_OFFSET + size;
+		if(addr - DATA_OFFSET < sectionStart[section])
+			sectionStart[section] = addr - DATA_OFFSET;
+		if(inputEnd > sectionEnd[section])
+			sectionEnd[section] = inputEnd;
+	}
+	closeSymbols(firstSymbol, inputEnd);
+}
+
+static int compareSize(const void* a, const void* b) {
+	const struct Symbol* sa = a;
+	const struct Symbol* sb = b;
+	return sa->size < sb->size ? 1 : sa->size > sb->size ? -1 : strcmp(sa->name, sb->name);
+}
+
+int main(int argc, char** argv) {
+	unsigned long headroom = 0, total, stack, grand = 0;
+	int largest = 5, argi = 1, i, s, shown;
+	FILE* f;
+
+	for(; argi < argc && argv[argi][0] == '-'; argi++) {
+		if(strcmp(argv[argi], "-h") == 0 && argi+1 < argc)
+			headroom = strtoul(argv[++argi], NULL, 0);
+		else if(strcmp(argv[argi], "-n") == 0 && argi+1 < argc)
+			largest = atoi(argv[++argi]);
+		else
+			break;
+	}
+	if(argc - argi != 1) {
+		fprintf(stderr, "usage: memmap [-h headroom] [-n largest] game.map\n");
+		return 1;
+	}
+	f = fopen(argv[argi], "r");
+	if(!f) {
+		fprintf(stderr, "memmap: can't open %s\n", argv[argi]);
+		return 1;
+	}
+	parse(f);
+	fclose(f);
+	if(!bssEnd) {
+		fprintf(stderr, "memmap: no __bss_end in %s\n", argv[argi]);
+		return 1;
+	}
+	qsort(symbols, symbolCount, sizeof(symbols[0]), compareSize);
+
+	printf("RAM use       .noinit    .data     .bss    total\n");
+	for(s = 0; s < SUBSYSTEMS; s++) {
+		total = used[s][SEC_NOINIT] + used[s][SEC_DATA] + used[s][SEC_BSS];
+		if(!total)
+			continue;
+		grand += total;
+		printf("  %-10s %8lu %8lu %8lu %8lu\n", subsystems[s].name,
+				used[s][SEC_NOINIT], used[s][SEC_DATA], used[s][SEC_BSS], total);
+		for(i = 0, shown = 0; i < symbolCount && shown < largest; i++) {
+			if(symbols[i].subsystem == s) {
+				printf("    %-30s %6lu\n", symbols[i].name, symbols[i].size);
+				shown++;
+			}
+		}
+	}
+	printf("  %-10s %35lu\n", "all", grand);
+
+	// .noinit is pinned below .data, what it doesn't use is lost
+	if(sectionEnd[SEC_NOINIT] && sectionStart[SEC_DATA] > sectionEnd[SEC_NOINIT])
+		printf("\n%lu bytes unused between .noinit and .data\n", sectionStart[SEC_DATA] - sectionEnd[SEC_NOINIT]);
+
+	stack = bssEnd < RAM_END ? RAM_END - bssEnd : 0;
+	printf("variables end at 0x%04lx, %lu bytes left for the stack (headroom %lu)\n", bssEnd, stack, headroom);
+	if(stack < headroom) {
+		fprintf(stderr, "memmap: only %lu bytes left for the stack, %lu are needed\n", stack, headroom);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,240 @@
+/*
+ * Builds ASSETS.PAK, the asset pack the game reads from the SD card,
+ * from res/levels.txt.
+ *
+ * The pack is one file so the game only opens it once, then finds each
+ * asset by a binary search in its index and seeks straight to the data:
+ *
+ *   header  "UTPK", version, 0, entry count (16 bits)
+ *   index   per entry: key, size (16 bits each), offset (32 bits),
+ *           sorted by key
+ *   data    the assets, in index order
+ *
+ * All numbers are little-endian. The key is the asset type in the high
+ * byte and its number in the low byte, levels are type 1 numbered in
+ * the order of levels.txt. A level is its width, its height and one byte
+ * per cell, row by row, like the level arrays of tacticsCore.c.
+ *
+ * Tiles, tile maps and sprites stay in flash, the video mode reads them
+ * from there while drawing.
+ *
+ * Build and run on the host:
+ *   gcc -o packgen packgen.c
+ *   ./packgen ../res/levels.txt ASSETS.PAK
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// must match tacticsCore.c
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 8
+#define PACK_ENTRY_SIZE 8
+#define PACK_LEVEL 0x01
+#define MAX_LEVEL_WIDTH 30
+#define LEVEL_HEIGHT 11
+#define MAX_PROPERTIES 20
+#define CT 0x04
+#define BS 0x05
+
+#define MAX_ENTRIES 256
+#define MAX_LEVEL_SIZE (2 + MAX_LEVEL_WIDTH * LEVEL_HEIGHT)
+
+// cell names, as in tacticsCore.c
+static const struct {
+	const char* name;
+	unsigned char value, mask;
+} cellNames[] = {
+	{"PL", 0x01, 0x07}, {"MO", 0x02, 0x07}, {"FO", 0x03, 0x07}, {"CT", 0x04, 0x07}, {"BS", 0x05, 0x07},
+	{"UN1", 0x08, 0x38}, {"UN2", 0x10, 0x38}, {"UN3", 0x18, 0x38}, {"UN4", 0x20, 0x38}, {"UN5", 0x28, 0x38},
+	{"PL1", 0x80, 0xC0}, {"PL2", 0x40, 0xC0}, {"NEU", 0x00, 0xC0},
+	{NULL, 0, 0}
+};
+
+struct Entry {
+	unsigned int key;
+	unsigned int size;
+	unsigned char* data;
+};
+
+static struct Entry entries[MAX_ENTRIES];
+static int entryCount;
+
+static const char* fileName;
+static int lineNo;
+
+static void fail(const char* msg) {
+	fprintf(stderr, "packgen: %s:%d: %s\n", fileName, lineNo, msg);
+	exit(1);
+}
+
+static unsigned char parseCell(char* tok) {
+	unsigned char cell = 0, seen = 0;
+	char* part;
+	int i;
+
+	for(part = strtok(tok, "|"); part; part = strtok(NULL, "|")) {
+		for(i = 0; cellNames[i].name; i++) {
+			if(strcmp(part, cellNames[i].name) == 0)
+				break;
+		}
+		if(!cellNames[i].name)
+			fail("unknown cell name");
+		if(seen & cellNames[i].mask)
+			fail("cell has two terrains, owners or units");
+		seen |= cellNames[i].mask;
+		cell |= cellNames[i].value;
+	}
+	if(!(seen & 0x07))
+		fail("cell has no terrain");
+	if((cell & 0x38) && !(cell & 0xC0))
+		fail("unit has no owner");
+	return cell;
+}
+
+static struct Entry* newLevel(void) {
+	struct Entry* e;
+	int levels = 0, i;
+
+	for(i = 0; i < entryCount; i++)
+		levels += (entries[i].key >> 8) == PACK_LEVEL;
+	if(entryCount == MAX_ENTRIES || levels == 256)
+		fail("too many assets");
+	e = &entries[entryCount++];
+	e->key = PACK_LEVEL << 8 | levels;
+	e->data = calloc(1, MAX_LEVEL_SIZE);
+	if(!e->data)
+		fail("out of memory");
+	return e;
+}
+
+static void finishLevel(struct Entry* e) {
+	unsigned int properties = 0, i, p;
+	unsigned char units[2] = {0, 0}, bases[2] = {0, 0};
+
+	if(!e)
+		return;
+	if(e->data[1] == 0)
+		fail("level has no rows");
+	for(i = 2; i < e->size; i++) {
+		properties += (e->data[i] & 0x07) == CT || (e->data[i] & 0x07) == BS;
+		p = e->data[i] & 0x80 ? 0 : 1;
+		if(e->data[i] & 0xC0) {
+			units[p] |= (e->data[i] & 0x38) != 0;
+			bases[p] |= (e->data[i] & 0x07) == BS;
+		}
+	}
+	// one player may end up owning them all
+	if(properties > MAX_PROPERTIES)
+		fail("more than 20 cities and bases");
+	// the game is lost without either
+	if(!units[0] || !units[1] || !bases[0] || !bases[1])
+		fail("each player needs a unit and a base");
+}
+
+static void parse(FILE* f) {
+	char line[1024], *tok, *cells[MAX_LEVEL_WIDTH + 1], *comment;
+	struct Entry* level = NULL;
+	int width, x;
+
+	while(fgets(line, sizeof(line), f)) {
+		lineNo++;
+		comment = strchr(line, '#');
+		if(comment)
+			*comment = 0;
+		tok = strtok(line, " \t\r\n");
+		if(!tok)
+			continue;
+
+		if(strcmp(tok, "level") == 0) {
+			finishLevel(level);
+			level = newLevel();
+			continue;
+		}
+		if(!level)
+			fail("cells before the first level");
+
+		// split the row first, parseCell uses strtok too
+		for(width = 0; tok; tok = strtok(NULL, " \t\r\n")) {
+			if(width == MAX_LEVEL_WIDTH)
+				fail("level wider than 30");
+			cells[width++] = tok;
+		}
+		if(level->data[1] == LEVEL_HEIGHT)
+			fail("level higher than 11");
+		if(level->data[1] == 0)
+			level->data[0] = width;
+		else if(level->data[0] != width)
+			fail("rows of different width");
+		for(x = 0; x < width; x++)
+			level->data[2 + level->data[1] * width + x] = parseCell(cells[x]);
+		level->data[1]++;
+		level->size = 2 + level->data[0] * level->data[1];
+	}
+	lineNo = 0;
+	finishLevel(level);
+	if(!entryCount)
+		fail("no levels");
+}
+
+static void put16(FILE* f, unsigned int v) {
+	fputc(v & 0xff, f);
+	fputc(v >> 8 & 0xff, f);
+}
+
+static void put32(FILE* f, unsigned long v) {
+	put16(f, v & 0xffff);
+	put16(f, v >> 16 & 0xffff);
+}
+
+static int compareKey(const void* a, const void* b) {
+	return (int)((const struct Entry*)a)->key - (int)((const struct Entry*)b)->key;
+}
+
+int main(int argc, char** argv) {
+	unsigned long offset;
+	FILE* f;
+	int i;
+
+	if(argc != 3) {
+		fprintf(stderr, "usage: packgen levels.txt ASSETS.PAK\n");
+		return 1;
+	}
+	fileName = argv[1];
+	f = fopen(fileName, "r");
+	if(!f) {
+		fprintf(stderr, "packgen: can't open %s\n", fileName);
+		return 1;
+	}
+	parse(f);
+	fclose(f);
+	qsort(entries, entryCount, sizeof(entries[0]), compareKey);
+
+	f = fopen(argv[2], "wb");
+	if(!f) {
+		fprintf(stderr, "packgen: can't create %s\n", argv[2]);
+		return 1;
+	}
+	fwrite("UTPK", 1, 4, f);
+	fputc(PACK_VERSION, f);
+	fputc(0, f);
+	put16(f, entryCount);
+
+	offset = PACK_HEADER_SIZE + (unsigned long)entryCount * PACK_ENTRY_SIZE;
+	for(i = 0; i < entryCount; i++) {
+		put16(f, entries[i].key);
+		put16(f, entries[i].size);
+		put32(f, offset);
+		offset += entries[i].size;
+	}
+	for(i = 0; i < entryCount; i++)
+		fwrite(entries[i].data, 1, entries[i].size, f);
+	if(fclose(f) != 0) {
+		fprintf(stderr, "packgen: can't write %s\n", argv[2]);
+		return 1;
+	}
+
+	printf("packgen: %d assets, %lu bytes\n", entryCount, offset);
+	return 0;
+}
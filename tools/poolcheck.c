@@ -0,0 +1,267 @@
+/*
+ * Stress test of the unit pool of tacticsCore.c (initUnitPool, addUnit,
+ * removeUnit and removeUnitByIndex), with the game code itself included
+ * and its screen and sound calls stubbed out.
+ *
+ * Units are added and removed at random on a full size map, for both
+ * players and all unit types, until the pool and the teams are full
+ * many times over. After each change:
+ * - the free list and the two players' lists hold every slot once
+ * - each list only holds free slots or units of its player
+ * - unitCount matches the lists and stays under MAX_TEAM_UNITS
+ * - the map and the units agree on where each unit is
+ * - each player sees exactly what its units can see
+ * An add must fail only on an occupied square, a full pool or a team
+ * at its cap. Freeing a free slot must stop the game with its ERROR
+ * and leave the pool as it was.
+ *
+ * Build from default/ with make poolcheck, then:
+ *   ./poolcheck [-n operations] [-s seeds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#define main gameMain // not run, the checks call the game's functions
+#include "../tacticsCore.c"
+#undef main
+
+// the screen and sound are not used, ERROR ends in WaitVsync
+static jmp_buf stopped;
+static int expectStop;
+static const char* lastPrint = "";
+
+u8 vram[VRAM_TILES_H * VRAM_TILES_V];
+struct SpriteStruct sprites[MAX_SPRITES];
+ScreenType Screen;
+unsigned char free_tile_index;
+
+void WaitVsync(int count) {
+	if(expectStop)
+		longjmp(stopped, 1);
+	fprintf(stderr, "poolcheck: the game stopped with ERROR(\"%s\")\n", lastPrint);
+	exit(1);
+}
+
+void Print(int x, int y, const char* string) { lastPrint = string; }
+void PrintByte(int x, int y, unsigned char val, bool zeropad) {}
+void PrintChar(int x, int y, char c) {}
+void PrintInt(int x, int y, unsigned int val, bool zeropad) {}
+void Fill(int x, int y, int width, int height, int tile) {}
+void SetTile(char x, char y, unsigned int tileId) {}
+void ClearVram(void) {}
+void DrawMap2(unsigned char x, unsigned char y, const char* map) {}
+void MapSprite(unsigned char startSprite, const char* map) {}
+void MoveSprite(unsigned char startSprite, unsigned char x, unsigned char y, unsigned char width, unsigned char height) {}
+void SetTileTable(const char* data) {}
+void SetSpritesTileTable(const char* data) {}
+void SetFontTilesIndex(unsigned char index) {}
+void FadeIn(unsigned char speed, bool blocking) {}
+void FadeOut(unsigned char speed, bool blocking) {}
+bool IsFadeActive(void) { return false; }
+u8 GetVsyncFlag(void) { return 0; }
+unsigned int ReadJoypad(unsigned char joypadNo) { return 0; }
+void InitMusicPlayer(const struct PatchStruct* patchPointersParam) {}
+u8 TriggerFxPriority(u8 patch, u8 volume, u8 priority) { return 0; }
+u16 GetMusicCycles(bool worst) { return 0; }
+void StartSongStream(u32 firstSector) {}
+void PauseSongStream() {}
+void ResumeSongStream() {}
+u8 mmc_masterInit(u8* buffer) { return 0; }
+u8 mmc_listDir(mmc_File* files, u8 count, const char* extFilter) { return 0; }
+
+static const char types[] = {UN1, UN2, UN3, UN4, UN5};
+static const unsigned char players[] = {PL1, PL2};
+static unsigned long rngState;
+
+static unsigned int rnd(unsigned int n) {
+	rngState = rngState * 6364136223846793005UL + 1442695040888963407UL;
+	return (rngState >> 33) % n;
+}
+
+static void blankLevel(void) {
+	unsigned char x, y;
+
+	levelWidth = MAX_LEVEL_WIDTH;
+	levelHeight = LEVEL_HEIGHT;
+	for(x = 0; x < MAX_LEVEL_WIDTH; x++) {
+		for(y = 0; y < LEVEL_HEIGHT; y++) {
+			levelBuffer[x][y].info = PL;
+			levelBuffer[x][y].unit = 0xFF;
+		}
+	}
+	memset(visibility, 0, sizeof(visibility));
+	initUnitPool();
+}
+
+static int check(unsigned long op) {
+	unsigned char seen[MAX_UNITS], sees[2][BITMAP_SIZE];
+	unsigned char u, p, x, y, n, r;
+	signed char dx, dy;
+	int placed = 0, live = 0;
+
+	memset(seen, 0, sizeof(seen));
+	for(u = unitFirstEmpty, n = 0; u != 0xFF && n <= MAX_UNITS; u = unitNext[u], n++) {
+		if(u >= MAX_UNITS || seen[u]++ || unitList[u].isUnit) {
+			fprintf(stderr, "poolcheck: operation %lu: slot %d is on the free list wrongly\n", op, u);
+			return 1;
+		}
+	}
+	memset(sees, 0, sizeof(sees));
+	for(p = 0; p < 2; p++) {
+		for(u = unitFirstOwned[p], n = 0; u != 0xFF && n <= MAX_UNITS; u = unitNext[u], n++) {
+			if(u >= MAX_UNITS || seen[u]++ || !unitList[u].isUnit || GETPLAY(unitList[u].info) != players[p]) {
+				fprintf(stderr, "poolcheck: operation %lu: slot %d is on player %d's list wrongly\n", op, u, p + 1);
+				return 1;
+			}
+			if(levelBuffer[unitList[u].xPos][unitList[u].yPos].unit != u) {
+				fprintf(stderr, "poolcheck: operation %lu: unit %d is not on the map where it is\n", op, u);
+				return 1;
+			}
+			r = getSightRange(unitList[u].info);
+			for(dx = -r; dx <= r; dx++) {
+				for(dy = -(r - ABS(dx)); dy <= r - ABS(dx); dy++) {
+					x = unitList[u].xPos + dx;
+					y = unitList[u].yPos + dy;
+					if(x < levelWidth && y < levelHeight)
+						SETCELLBIT(sees[p], x, y);
+				}
+			}
+			live++;
+		}
+		if(n != unitCount[p] || n > MAX_TEAM_UNITS) {
+			fprintf(stderr, "poolcheck: operation %lu: player %d has %d units, unitCount says %d\n", op, p + 1, n, unitCount[p]);
+			return 1;
+		}
+		if(memcmp(sees[p], visibility[p], BITMAP_SIZE) != 0) {
+			fprintf(stderr, "poolcheck: operation %lu: player %d doesn't see what its units see\n", op, p + 1);
+			return 1;
+		}
+	}
+	for(u = 0; u < MAX_UNITS; u++) {
+		if(!seen[u]) {
+			fprintf(stderr, "poolcheck: operation %lu: slot %d is on no list\n", op, u);
+			return 1;
+		}
+	}
+	for(x = 0; x < levelWidth; x++) {
+		for(y = 0; y < levelHeight; y++)
+			placed += levelBuffer[x][y].unit != 0xFF;
+	}
+	if(placed != live) {
+		fprintf(stderr, "poolcheck: operation %lu: %d units on the map, %d in the lists\n", op, placed, live);
+		return 1;
+	}
+	return 0;
+}
+
+static void hung(int sig) {
+	fprintf(stderr, "poolcheck: freeing a slot twice didn't stop the game\n");
+	_Exit(1);
+}
+
+// frees a slot that is already free, which must stop the game
+static int doubleFree(unsigned long op, unsigned char u) {
+	static const struct itimerval timeout = {{0, 0}, {5, 0}}, cancel;
+	unsigned char next[MAX_UNITS], first = unitFirstEmpty;
+	struct Unit units[MAX_UNITS];
+
+	memcpy(next, unitNext, sizeof(next));
+	memcpy(units, unitList, sizeof(units));
+	expectStop = 1;
+	if(setjmp(stopped) == 0) {
+		// without the check it walks the lists forever
+		signal(SIGALRM, hung);
+		setitimer(ITIMER_REAL, &timeout, NULL);
+		removeUnitByIndex(u);
+		fprintf(stderr, "poolcheck: operation %lu: slot %d was freed twice\n", op, u);
+		return 1;
+	}
+	setitimer(ITIMER_REAL, &cancel, NULL);
+	expectStop = 0;
+	if(first != unitFirstEmpty || memcmp(next, unitNext, sizeof(next)) != 0 || memcmp(units, unitList, sizeof(units)) != 0) {
+		fprintf(stderr, "poolcheck: operation %lu: freeing slot %d twice changed the pool\n", op, u);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	unsigned long operations = 100000, op, adds = 0, refused = 0, removes = 0, stops = 0, full = 0;
+	int seeds = 4, argi = 1, s, p;
+	unsigned char u, x, y, player, expectFail;
+
+	for(; argi < argc && argv[argi][0] == '-'; argi++) {
+		if(strcmp(argv[argi], "-n") == 0 && argi+1 < argc)
+			operations = atol(argv[++argi]);
+		else if(strcmp(argv[argi], "-s") == 0 && argi+1 < argc)
+			seeds = atoi(argv[++argi]);
+		else
+			break;
+	}
+	if(argi < argc || seeds < 1) {
+		fprintf(stderr, "usage: poolcheck [-n operations] [-s seeds]\n");
+		return 1;
+	}
+
+	for(s = 0; s < seeds; s++) {
+		rngState = s + 1;
+		blankLevel();
+		for(op = 0; op < operations; op++) {
+			// lean toward adding so the teams reach their cap often
+			if(rnd(100) < 60) {
+				x = rnd(levelWidth);
+				y = rnd(levelHeight);
+				player = players[rnd(2)];
+				p = PLINDEX(player);
+				expectFail = levelBuffer[x][y].unit != 0xFF || unitFirstEmpty == 0xFF || unitCount[p] >= MAX_TEAM_UNITS;
+				full += unitCount[p] >= MAX_TEAM_UNITS;
+				u = addUnit(x, y, player, types[rnd(sizeof(types))]);
+				if((u == 0xFF) != expectFail) {
+					fprintf(stderr, "poolcheck: operation %lu: adding a unit %s\n", op, expectFail ? "should have failed" : "failed");
+					return 1;
+				}
+				adds += u != 0xFF;
+				refused += u == 0xFF;
+			}
+			else if(rnd(50) == 0) {
+				u = rnd(MAX_UNITS + 8);
+				if(u < MAX_UNITS && unitList[u].isUnit)
+					continue;
+				if(doubleFree(op, u))
+					return 1;
+				stops++;
+			}
+			else {
+				u = rnd(MAX_UNITS);
+				if(!unitList[u].isUnit)
+					continue;
+				if(rnd(2))
+					removeUnitByIndex(u);
+				else
+					removeUnit(unitList[u].xPos, unitList[u].yPos);
+				removes++;
+			}
+			if(check(op))
+				return 1;
+		}
+
+		// and everything back
+		for(u = 0; u < MAX_UNITS; u++) {
+			if(unitList[u].isUnit)
+				removeUnitByIndex(u);
+		}
+		if(check(op) || unitCount[0] != 0 || unitCount[1] != 0) {
+			fprintf(stderr, "poolcheck: units left after removing them all\n");
+			return 1;
+		}
+	}
+
+	printf("%d seeds, %lu operations each: %lu units added, %lu refused (%lu at a team's cap), %lu removed, %lu double frees stopped\n",
+			seeds, operations, adds, refused, full, removes, stops);
+	return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * Check of the kernel random numbers (RngNext, RngRange and RngJump in
+ * kernel/uzeboxCore.c), built from the kernel sources like the other
+ * kernel checks.
+ *
+ * - RngJump must land where as many RngNext calls do, for every count up
+ *   to a few thousand, at random points of a long walk and when jumps
+ *   are chained, and the period must be the full 2^32.
+ * - Every one of the 65536 outputs of RngNext is fed to RngRange for each
+ *   count from 1 to 255: each value must get as many outputs as the others,
+ *   or one more, which bounds the bias.
+ * - RngRange draws from several seeds must pass a chi-square test, for
+ *   single values and for pairs of successive values.
+ * - The game splits a cosmetic stream off the gameplay one by jumping it
+ *   ahead (tacticsCore.c): paired draws of the two must not be correlated
+ *   and must pass a chi-square test.
+ *
+ * Rejections at the 99.9th percentile are expected once in a while, a
+ * test fails when more than a tenth of the seeds are rejected.
+ *
+ * Build from default/ with make rngcheck, then:
+ *   ./rngcheck [-n draws per value] [-s seeds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "uzebox.h"
+
+static int failures;
+
+static void fail(const char* what) {
+	fprintf(stderr, "rngcheck: %s\n", what);
+	failures++;
+}
+
+static unsigned long rngState = 7;
+
+static u32 rnd32(void) {
+	rngState = rngState * 6364136223846793005UL + 1442695040888963407UL;
+	return rngState >> 32;
+}
+
+static void jumps(void) {
+	struct Rng walk, jumped;
+	u32 seed, n, a, b, target[64];
+	int i;
+
+	for(seed = 0; seed < 8; seed++) {
+		RngSeed(&walk, seed * 0x9e3779b9UL);
+		for(n = 0; n <= 4096; n++) {
+			RngSeed(&jumped, seed * 0x9e3779b9UL);
+			RngJump(&jumped, n);
+			if(jumped.state != walk.state) {
+				fail("a short jump differs from stepping");
+				return;
+			}
+			RngNext(&walk);
+		}
+	}
+
+	// random points of a walk of 2^24 steps, in order
+	for(i = 0; i < 64; i++)
+		target[i] = rnd32() >> 8;
+	for(i = 1; i < 64; i++) {
+		for(n = i; n > 0 && target[n - 1] > target[n]; n--) {
+			a = target[n];
+			target[n] = target[n - 1];
+			target[n - 1] = a;
+		}
+	}
+	RngSeed(&walk, 12345);
+	for(n = 0, i = 0; i < 64; n++) {
+		for(; i < 64 && target[i] == n; i++) {
+			RngSeed(&jumped, 12345);
+			RngJump(&jumped, n);
+			if(jumped.state != walk.state) {
+				fail("a long jump differs from stepping");
+				return;
+			}
+		}
+		RngNext(&walk);
+	}
+
+	for(i = 0; i < 1000; i++) {
+		a = rnd32();
+		b = rnd32();
+		RngSeed(&walk, i);
+		RngJump(&walk, a);
+		RngJump(&walk, b);
+		RngSeed(&jumped, i);
+		RngJump(&jumped, a + b);
+		if(walk.state != jumped.state) {
+			fail("two jumps differ from their sum");
+			return;
+		}
+	}
+
+	// 2^32 steps is 2^32-1 and one more, the period can't divide 2^31
+	RngSeed(&walk, 99);
+	RngJump(&walk, 0xffffffffUL);
+	RngNext(&walk);
+	RngSeed(&jumped, 99);
+	RngJump(&jumped, 0x80000000UL);
+	if(walk.state != 99 || jumped.state == 99)
+		fail("the period is not 2^32");
+
+	printf("jumps: stepping, chained jumps and the 2^32 period agree\n");
+}
+
+static void ranges(void) {
+	static struct Rng before[65536];
+	unsigned long hits[256], least, most;
+	struct Rng rng;
+	double worst = 0;
+	int count, worstCount = 0;
+	u32 v;
+
+	// the state that makes RngNext return v, one step back from v << 16
+	for(v = 0; v < 65536; v++) {
+		RngSeed(&before[v], v << 16);
+		RngJump(&before[v], 0xffffffffUL);
+	}
+
+	for(count = 1; count < 256; count++) {
+		memset(hits, 0, sizeof(hits));
+		for(v = 0; v < 65536; v++) {
+			rng = before[v];
+			hits[RngRange(&rng, count)]++;
+		}
+		for(v = 0, least = ~0UL, most = 0; v < (u32)count; v++) {
+			if(hits[v] < least)
+				least = hits[v];
+			if(hits[v] > most)
+				most = hits[v];
+		}
+		if(least != 65536 / count || most > least + 1 || hits[count] != 0) {
+			fail("RngRange splits the outputs unevenly");
+			return;
+		}
+		if((double)most / least - 1 > worst) {
+			worst = (double)most / least - 1;
+			worstCount = count;
+		}
+	}
+	printf("ranges: counts 1 to 255 split the outputs evenly, at worst %.3f%% more likely (count %d)\n",
+			worst * 100, worstCount);
+}
+
+// chi-square above the 99.9th percentile, Wilson-Hilferty approximation
+static int unlikely(double chi, int cells) {
+	double df = cells - 1, t = 2 / (9 * df);
+	return chi > df * pow(1 - t + 3.09 * sqrt(t), 3);
+}
+
+static void chiSquare(int draws, int seeds) {
+	static const int counts[] = {2, 3, 5, 6, 7, 10, 11, 16, 100, 255};
+	static unsigned long cells[256 * 256];
+	struct Rng rng;
+	double chi, expect;
+	int c, s, i, n, cellCount, prev, value, rejected;
+
+	printf("chi-square, %d seeds, %d draws per cell\ncount  single  pairs\n", seeds, draws);
+	for(c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++) {
+		printf("%5d", counts[c]);
+		for(n = 1; n <= 2; n++) {
+			cellCount = n == 1 ? counts[c] : counts[c] * counts[c];
+			if(n == 2 && cellCount > 256 * 16) {
+				printf("      -");
+				continue;
+			}
+			for(s = 0, rejected = 0; s < seeds; s++) {
+				memset(cells, 0, cellCount * sizeof(cells[0]));
+				RngSeed(&rng, rnd32());
+				prev = RngRange(&rng, counts[c]);
+				for(i = 0; i < draws * cellCount; i++) {
+					value = RngRange(&rng, counts[c]);
+					cells[n == 1 ? value : prev * counts[c] + value]++;
+					prev = value;
+				}
+				expect = draws;
+				for(i = 0, chi = 0; i < cellCount; i++)
+					chi += (cells[i] - expect) * (cells[i] - expect) / expect;
+				rejected += unlikely(chi, cellCount);
+			}
+			printf("  %2d/%-3d", seeds - rejected, seeds);
+			if(rejected > seeds / 10 + 1)
+				fail("RngRange fails the chi-square test");
+		}
+		printf("\n");
+	}
+}
+
+#define FX_JUMP 0x9E3779B9UL // as in tacticsCore.c
+
+static void streams(void) {
+	static unsigned long cells[256];
+	struct Rng game, fx;
+	double sum = 0, chi = 0, n = 1 << 20, expect = n / 256;
+	u16 a, b;
+	int i;
+
+	RngSeed(&game, 0xcafe);
+	fx = game;
+	RngJump(&fx, FX_JUMP);
+	for(i = 0; i < (int)n; i++) {
+		a = RngNext(&game);
+		b = RngNext(&fx);
+		sum += (a - 32767.5) * (b - 32767.5);
+		cells[(a >> 12) << 4 | b >> 12]++;
+	}
+	sum /= n * (65536.0 * 65536.0 - 1) / 12;
+	for(i = 0; i < 256; i++)
+		chi += (cells[i] - expect) * (cells[i] - expect) / expect;
+	printf("streams: game and cosmetic draws, correlation %.5f, chi-square %.1f over 256 cells\n", sum, chi);
+	if(fabs(sum) > 4 / sqrt(n) || unlikely(chi, 256))
+		fail("the game and cosmetic streams are correlated");
+}
+
+int main(int argc, char** argv) {
+	int draws = 100, seeds = 20, argi = 1;
+
+	for(; argi < argc && argv[argi][0] == '-'; argi++) {
+		if(strcmp(argv[argi], "-n") == 0 && argi+1 < argc)
+			draws = atoi(argv[++argi]);
+		else if(strcmp(argv[argi], "-s") == 0 && argi+1 < argc)
+			seeds = atoi(argv[++argi]);
+		else
+			break;
+	}
+	if(argi < argc || draws < 5 || seeds < 1) {
+		fprintf(stderr, "usage: rngcheck [-n draws per value] [-s seeds]\n");
+		return 1;
+	}
+
+	jumps();
+	ranges();
+	chiSquare(draws, seeds);
+	streams();
+	return failures != 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * Generates res/rules.inc from res/rules.txt, the unit and terrain rules
+ * of the game: names, costs, sight and attack ranges, move costs and the
+ * combat table used by getDamage.
+ *
+ * For every attacker, defender and terrain it precomputes the smallest and
+ * largest damage a hit can do, so the game only needs one lookup for both
+ * the attack preview and the real roll. Every other rule is a single byte
+ * in a fixed-size record per unit.
+ *
+ * The tables are plain arrays marked PROGMEM, host tools can include
+ * rules.inc with the stand-in headers of tools/host.
+ *
+ * Build and run on the host:
+ *   gcc -o rulesgen rulesgen.c
+ *   ./rulesgen ../res/rules.txt > ../res/rules.inc
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_UNITS 8
+#define MAX_TERRAINS 8
+#define NAME_SIZE 10 // longest name plus the terminator
+
+// record of each unit in _unitRules, must match the RULES_* offsets below
+#define RULE_COST 0
+#define RULE_SIGHT 1
+#define RULE_RANGE 2
+#define RULE_MOVE 3
+
+static char unitNames[MAX_UNITS][NAME_SIZE];
+static char terrainNames[MAX_TERRAINS][NAME_SIZE];
+static int units, terrains, boost = -1;
+
+static int unitRules[MAX_UNITS][RULE_MOVE+MAX_TERRAINS];
+static int damage[MAX_UNITS][MAX_UNITS];
+static char hasDamage[MAX_UNITS];
+
+// terrain modifiers, the last row is the "*" default
+static int modifier[MAX_UNITS+1][MAX_TERRAINS];
+static char hasModifier[MAX_UNITS+1];
+
+static const char* fileName;
+static int lineNo;
+
+static void fail(const char* msg) {
+	fprintf(stderr, "rulesgen: %s:%d: %s\n", fileName, lineNo, msg);
+	exit(1);
+}
+
+static int findUnit(const char* name) {
+	int i;
+	for(i = 0; i < units; i++) {
+		if(strcmp(unitNames[i], name) == 0)
+			return i;
+	}
+	fail("unknown unit");
+	return -1;
+}
+
+// reads count numbers from the rest of the line
+static void readValues(int* values, int count, int min, int max) {
+	char* tok;
+	int i;
+	for(i = 0; i < count; i++) {
+		tok = strtok(NULL, " \t\r\n");
+		if(!tok)
+			fail("missing value");
+		values[i] = atoi(tok);
+		if(values[i] < min || values[i] > max)
+			fail("value out of range");
+	}
+	if(strtok(NULL, " \t\r\n"))
+		fail("too many values");
+}
+
+static void readName(char* dst) {
+	char* tok = strtok(NULL, " \t\r\n");
+	if(!tok)
+		fail("missing name");
+	if(strlen(tok) >= NAME_SIZE)
+		fail("name too long");
+	strcpy(dst, tok);
+}
+
+static void parse(FILE* f) {
+	char line[256], *tok, *comment;
+	int u;
+
+	while(fgets(line, sizeof(line), f)) {
+		lineNo++;
+		comment = strchr(line, '#');
+		if(comment)
+			*comment = 0;
+		tok = strtok(line, " \t\r\n");
+		if(!tok)
+			continue;
+
+		if(strcmp(tok, "terrains") == 0) {
+			while((tok = strtok(NULL, " \t\r\n"))) {
+				if(terrains == MAX_TERRAINS)
+					fail("too many terrains");
+				if(strlen(tok) >= NAME_SIZE)
+					fail("name too long");
+				strcpy(terrainNames[terrains++], tok);
+			}
+		}
+		else if(strcmp(tok, "unit") == 0) {
+			if(!terrains)
+				fail("terrains must come before the units");
+			if(units == MAX_UNITS)
+				fail("too many units");
+			readName(unitNames[units]);
+			readValues(unitRules[units], RULE_MOVE+terrains, 0, 127);
+			units++;
+		}
+		else if(strcmp(tok, "damage") == 0) {
+			tok = strtok(NULL, " \t\r\n");
+			u = tok ? findUnit(tok) : -1;
+			if(u < 0)
+				fail("missing unit");
+			readValues(damage[u], units, 0, 127);
+			hasDamage[u] = 1;
+		}
+		else if(strcmp(tok, "boost") == 0) {
+			readValues(&boost, 1, 0, 127);
+		}
+		else if(strcmp(tok, "terrain") == 0) {
+			tok = strtok(NULL, " \t\r\n");
+			if(!tok)
+				fail("missing unit");
+			u = strcmp(tok, "*") == 0 ? MAX_UNITS : findUnit(tok);
+			readValues(modifier[u], terrains, -127, 127);
+			hasModifier[u] = 1;
+		}
+		else {
+			fail("unknown rule");
+		}
+	}
+
+	lineNo = 0;
+	if(!units || !terrains)
+		fail("no units or no terrains");
+	if(boost < 0)
+		fail("no boost");
+	if(!hasModifier[MAX_UNITS])
+		fail("no default terrain modifier");
+	for(u = 0; u < units; u++) {
+		if(!hasDamage[u])
+			fail("a unit has no damage line");
+	}
+}
+
+static int clampDamage(int dmg) {
+	return dmg <= 0 ? 1 : dmg;
+}
+
+int main(int argc, char** argv) {
+	int src, dst, terr, min, max, mod, i;
+	FILE* f;
+
+	if(argc != 2) {
+		fprintf(stderr, "usage: rulesgen rules.txt\n");
+		return 1;
+	}
+	fileName = argv[1];
+	f = fopen(fileName, "r");
+	if(!f) {
+		fprintf(stderr, "rulesgen: can't open %s\n", fileName);
+		return 1;
+	}
+	parse(f);
+	fclose(f);
+
+	printf("/*\n");
+	printf(" * Generated by tools/rulesgen.c from %s, do not edit.\n", fileName);
+	printf(" */\n");
+	printf("#define RULES_UNITS %d\n", units);
+	printf("#define RULES_TERRAINS %d\n", terrains);
+	printf("#define RULES_NAME_SIZE %d\n\n", NAME_SIZE);
+
+	printf("// record of each unit in _unitRules\n");
+	printf("#define RULES_COST %d\n", RULE_COST);
+	printf("#define RULES_SIGHT %d\n", RULE_SIGHT);
+	printf("#define RULES_RANGE %d\n", RULE_RANGE);
+	printf("#define RULES_MOVE %d // one move cost per terrain\n", RULE_MOVE);
+	printf("#define RULES_UNIT_SIZE %d\n\n", RULE_MOVE+terrains);
+
+	printf("// names of the units, RULES_NAME_SIZE chars each\n");
+	printf("const char _unitNames[] PROGMEM =\n");
+	for(src = 0; src < units; src++) {
+		printf("\t\"%s", unitNames[src]);
+		for(i = strlen(unitNames[src]); i < NAME_SIZE; i++)
+			printf("\\0");
+		printf("\"%s\n", src == units-1 ? ";" : "");
+	}
+	printf("\n");
+
+	printf("// {cost, sight, range, move costs}, one record per unit\n");
+	printf("const unsigned char _unitRules[] PROGMEM = {\n");
+	for(src = 0; src < units; src++) {
+		printf("\t");
+		for(i = 0; i < RULE_MOVE+terrains; i++)
+			printf("%d,%s", unitRules[src][i], i == RULE_MOVE+terrains-1 ? "" : " ");
+		printf(" // %s\n", unitNames[src]);
+	}
+	printf("};\n\n");
+
+	printf("// {min, max} damage indexed by [attacker][defender][terrain]\n");
+	printf("const unsigned char _damageRange[] PROGMEM = {\n");
+	for(src = 0; src < units; src++) {
+		for(dst = 0; dst < units; dst++) {
+			printf("\t// %s vs %s\n\t", unitNames[src], unitNames[dst]);
+			for(terr = 0; terr < terrains; terr++) {
+				mod = hasModifier[src] ? modifier[src][terr] : modifier[MAX_UNITS][terr];
+				min = clampDamage(damage[src][dst] + mod);
+				max = clampDamage(damage[src][dst] + boost + mod);
+				if(max > 127)
+					fail("damage over 127");
+				printf("%d, %d,%s", min, max, terr == terrains-1 ? "" : " ");
+			}
+			printf("\n");
+		}
+	}
+	printf("};\n");
+	return 0;
+}
@@ -0,0 +1,341 @@
+/*
+ * Host renderer for the sound engine, writes what the console would play
+ * to a WAV file so patch and engine changes can be listened to and diffed
+ * without the hardware or the emulator.
+ *
+ * kernel/uzeboxSoundEngine.c is built unchanged against the stand-in AVR
+ * headers in tools/host. The assembler parts (note/wave setters and the
+ * inline mixer of soundMixerInline.s) are modelled here: ProcessMusic runs
+ * once per frame like in VSYNC, then one sample is mixed per scanline,
+ * 262 per frame at 15734Hz.
+ *
+ * Build from default/ with "make sndrender", which uses the game's kernel
+ * options and patches (res/patches.inc).
+ *
+ * Usage:
+ *   ./sndrender [-k kernelDir] [-n frames] [-p] out.wav [event...]
+ *
+ * Events, triggered at the start of the given frame:
+ *   frame:fx:patch[:volume[:priority]]		TriggerFxPriority
+ *   frame:note:channel:patch:note[:volume]	TriggerNote
+ *
+ * On the noise channel (3) a note plays the patch of that number, the
+ * patch given is ignored.
+ *
+ * -p prints the time spent in ProcessMusic and in the mixer per frame.
+ *
+ * "make sndcheck" renders every patch as effects and notes and compares
+ * the result with tools/sndcheck.wav. After a change to the patches or
+ * the engine that is meant to be heard, "make sndref" renders it again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "uzebox.h"
+
+#if SOUND_MIXER != MIXER_TYPE_INLINE
+	#error "only the inline mixer is modelled"
+#endif
+
+#ifndef PATCHES_INC
+	#define PATCHES_INC "../res/patches.inc"
+#endif
+#include PATCHES_INC
+#define PATCH_COUNT (sizeof(patches) / sizeof(patches[0]))
+
+#define SAMPLE_RATE 15734
+#define SAMPLES_PER_FRAME 262
+#define MAX_WAVES 32
+#define STEPTABLE_SIZE 128
+#define MAX_EVENTS 256
+
+// kernel symbols that live in the assembler files
+struct MixerStruct mixer;
+u8 waves[MAX_WAVES*256];
+u16 steptable[STEPTABLE_SIZE];
+volatile uint16_t TCNT1;
+unsigned char sync_phase, sync_pulse;
+
+struct RenderEvent {
+	unsigned long frame;
+	char isFx;
+	unsigned char channel, patch, note, volume, priority;
+};
+
+static struct RenderEvent events[MAX_EVENTS];
+static int eventCount;
+
+/*
+ * Reads the values of the ".byte" or ".word" lines of an assembler
+ * include, like data/sounds.inc and data/steptable.inc
+ */
+static int readAsmTable(const char* path, const char* directive, void* table, int size, int max) {
+	char line[1024], *p, *end, *comment;
+	int count = 0;
+	unsigned long v;
+	FILE* f = fopen(path, "r");
+
+	if(!f) {
+		fprintf(stderr, "sndrender: can't open %s\n", path);
+		exit(1);
+	}
+	while(fgets(line, sizeof(line), f)) {
+		p = strstr(line, directive);
+		comment = strstr(line, "//");
+		if(!p || (comment && comment < p))
+			continue;
+		p += strlen(directive);
+		while(1) {
+			v = strtoul(p, &end, 0);
+			if(end == p)
+				break;
+			if(count == max) {
+				fprintf(stderr, "sndrender: %s is too big\n", path);
+				exit(1);
+			}
+			if(size == 1)
+				((u8*)table)[count++] = v;
+			else
+				((u16*)table)[count++] = v;
+			p = end;
+			while(*p == ' ' || *p == '\t' || *p == ',')
+				p++;
+		}
+	}
+	fclose(f);
+	return count;
+}
+
+// models of the uzeboxSoundEngineCore.s setters, for the inline mixer
+
+void SetMixerNote(unsigned char channel, unsigned char note) {
+#if MIXER_CHAN4_TYPE == 0
+	if(channel == 3)
+		return;
+#endif
+	mixer.channels.all[channel].step = steptable[note];
+}
+
+void SetMixerWave(unsigned char channel, unsigned char patch) {
+	struct MixerWaveChannelStruct* ch = &mixer.channels.type.wave[channel];
+	unsigned int lo;
+
+#if MIXER_CHAN4_TYPE == 0
+	if(channel == 3) {
+		if(patch == 0xfe)
+			mixer.channels.type.noise.params &= 0xfe; // 7 bit lfsr
+		else if(patch == 0xff)
+			mixer.channels.type.noise.params |= 0x01; // 15 bit lfsr
+		return;
+	}
+#endif
+	// only the page changes, the position in the wave is kept
+	lo = ch->position ? (unsigned int)(ch->position - (const char*)waves) & 0xff : 0;
+	ch->position = (const char*)waves + patch*256 + lo;
+}
+
+// sample*volume>>8 like the mulsu/sign extension in the mixer
+static int scale(signed char sample, unsigned char volume) {
+	return (sample * volume) >> 8;
+}
+
+/*
+ * One sample of soundMixerInline.s update_sound
+ */
+static unsigned char mixSample() {
+	struct MixerWaveChannelStruct* ch;
+	struct MixerNoiseChannelStruct* noise = &mixer.channels.type.noise;
+	unsigned int pos, frac, bit;
+	int mix = 0, i;
+
+	// wave channels loop inside their 256 byte wave
+	for(i = 0; i < WAVE_CHANNELS; i++) {
+		ch = &mixer.channels.type.wave[i];
+		frac = ch->positionFrac + (ch->step & 0xff);
+		pos = (unsigned int)(ch->position - (const char*)waves);
+		pos = (pos & ~0xffu) | ((pos + (ch->step >> 8) + (frac >> 8)) & 0xff);
+		ch->positionFrac = frac;
+		ch->position = (const char*)waves + pos;
+		mix += scale(*ch->position, ch->volume);
+	}
+
+#if MIXER_CHAN4_TYPE == 0
+	// 7/15 bit lfsr, shifted every params>>1 samples
+	if(noise->divider-- == 0) {
+		noise->divider = noise->params >> 1;
+		bit = (noise->barrel ^ (noise->barrel >> 1)) & 1;
+		noise->barrel = (noise->barrel >> 1) & 0xffff;
+		noise->barrel = (noise->barrel & ~(1u << 14)) | (bit << 14);
+		if(!(noise->params & 1))
+			noise->barrel = (noise->barrel & ~(1u << 6)) | (bit << 6);
+	}
+	mix += scale((noise->barrel & 1) ? 127 : -128, noise->volume);
+#endif
+
+#if SOUND_CHANNEL_5_ENABLE == 1
+	ch = &mixer.channels.type.pcm;
+	if(ch->position) {
+		frac = ch->positionFrac + (ch->step & 0xff);
+		ch->positionFrac = frac;
+		ch->position += (ch->step >> 8) + (frac >> 8);
+		if(ch->position >= mixer.pcmLoopEnd)
+			ch->position = mixer.pcmLoopStart;
+		mix += scale(*ch->position, ch->volume);
+	}
+#endif
+
+	if(mix > 127)
+		mix = 127;
+	if(mix < -128)
+		mix = -128;
+	return mix + 128;
+}
+
+static void writeLE(FILE* f, unsigned long v, int bytes) {
+	while(bytes--) {
+		fputc(v & 0xff, f);
+		v >>= 8;
+	}
+}
+
+static void writeWavHeader(FILE* f, unsigned long samples) {
+	fwrite("RIFF", 1, 4, f);
+	writeLE(f, 36 + samples, 4);
+	fwrite("WAVEfmt ", 1, 8, f);
+	writeLE(f, 16, 4);
+	writeLE(f, 1, 2); // PCM
+	writeLE(f, 1, 2); // mono
+	writeLE(f, SAMPLE_RATE, 4);
+	writeLE(f, SAMPLE_RATE, 4);
+	writeLE(f, 1, 2);
+	writeLE(f, 8, 2); // unsigned 8 bit, like OCR2A
+	fwrite("data", 1, 4, f);
+	writeLE(f, samples, 4);
+}
+
+static int parseEvent(const char* arg, struct RenderEvent* e) {
+	char kind[8];
+	unsigned int a, b, c, d;
+	int n;
+
+	e->volume = 0xff;
+	e->priority = 0;
+	if(sscanf(arg, "%lu:%7[a-z]:%n", &e->frame, kind, &n) != 2)
+		return 0;
+	arg += n;
+	if(strcmp(kind, "fx") == 0) {
+		e->isFx = 1;
+		n = sscanf(arg, "%u:%u:%u", &a, &b, &c);
+		if(n < 1)
+			return 0;
+		e->patch = a;
+		if(e->patch >= PATCH_COUNT)
+			return 0;
+		if(n > 1) e->volume = b;
+		if(n > 2) e->priority = c;
+		return 1;
+	}
+	if(strcmp(kind, "note") == 0) {
+		e->isFx = 0;
+		n = sscanf(arg, "%u:%u:%u:%u", &a, &b, &c, &d);
+		if(n < 3 || a >= CHANNELS)
+			return 0;
+		e->channel = a;
+		e->patch = b;
+		e->note = c;
+		if(n > 3) e->volume = d;
+		// the noise channel plays the note as its patch, like drums in songs
+		return e->patch < PATCH_COUNT && (e->channel != 3 || e->note < PATCH_COUNT);
+	}
+	return 0;
+}
+
+static double elapsedNs(struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char** argv) {
+	const char* kernelDir = "../kernel";
+	char path[1024];
+	unsigned long frames = 120, frame;
+	int profile = 0, argi = 1, i, s;
+	double ns, musicTotal = 0, musicMax = 0, mixTotal = 0, mixMax = 0;
+	struct timespec start;
+	FILE* out;
+
+	for(; argi < argc && argv[argi][0] == '-'; argi++) {
+		if(strcmp(argv[argi], "-k") == 0 && argi+1 < argc)
+			kernelDir = argv[++argi];
+		else if(strcmp(argv[argi], "-n") == 0 && argi+1 < argc)
+			frames = strtoul(argv[++argi], NULL, 0);
+		else if(strcmp(argv[argi], "-p") == 0)
+			profile = 1;
+		else
+			break;
+	}
+	if(argi >= argc) {
+		fprintf(stderr, "usage: sndrender [-k kernelDir] [-n frames] [-p] out.wav [frame:fx:patch[:volume[:priority]]] [frame:note:channel:patch:note[:volume]]\n");
+		return 1;
+	}
+	out = fopen(argv[argi++], "wb");
+	if(!out) {
+		fprintf(stderr, "sndrender: can't create %s\n", argv[argi-1]);
+		return 1;
+	}
+	for(; argi < argc; argi++) {
+		if(eventCount == MAX_EVENTS || !parseEvent(argv[argi], &events[eventCount])) {
+			fprintf(stderr, "sndrender: bad event %s\n", argv[argi]);
+			return 1;
+		}
+		eventCount++;
+	}
+
+	snprintf(path, sizeof(path), "%s/data/sounds.inc", kernelDir);
+	readAsmTable(path, ".byte", waves, 1, sizeof(waves));
+	snprintf(path, sizeof(path), "%s/data/steptable.inc", kernelDir);
+	readAsmTable(path, ".word", steptable, 2, STEPTABLE_SIZE);
+
+	InitMusicPlayer(patches);
+	for(i = 0; i < WAVE_CHANNELS; i++)
+		SetMixerWave(i, 0);
+
+	writeWavHeader(out, frames * SAMPLES_PER_FRAME);
+	for(frame = 0; frame < frames; frame++) {
+		for(i = 0; i < eventCount; i++) {
+			if(events[i].frame != frame)
+				continue;
+			if(events[i].isFx)
+				TriggerFxPriority(events[i].patch, events[i].volume, events[i].priority);
+			else
+				TriggerNote(events[i].channel, events[i].patch, events[i].note, events[i].volume);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ProcessMusic();
+		ns = elapsedNs(&start);
+		musicTotal += ns;
+		if(ns > musicMax)
+			musicMax = ns;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(s = 0; s < SAMPLES_PER_FRAME; s++)
+			fputc(mixSample(), out);
+		ns = elapsedNs(&start);
+		mixTotal += ns;
+		if(ns > mixMax)
+			mixMax = ns;
+	}
+	fclose(out);
+
+	if(profile && frames) {
+		printf("ProcessMusic: %.0f ns average, %.0f ns worst per frame\n", musicTotal / frames, musicMax);
+		printf("mixer:        %.0f ns average, %.0f ns worst per frame\n", mixTotal / frames, mixMax);
+	}
+	return 0;
+}
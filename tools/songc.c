@@ -0,0 +1,360 @@
+/*
+ * Song compiler, turns a standard MIDI file into the fixed-width event
+ * stream played by the kernel when SONG_COMPILED=1.
+ *
+ * Times are resolved to frames (60Hz) using the file's tempo map, and
+ * controller values are pre-scaled, so the player only has to copy four
+ * bytes per event. Loops use the same "S" and "E" markers as midiconv.
+ *
+ * The worst case number of events landing on one frame is reported on
+ * stderr, with every frame that goes over the player's per-frame budget.
+ *
+ * -r writes the raw stream instead of a PROGMEM array, for songs
+ * streamed from the SD card with SONG_STREAMING=1.
+ *
+ * Build and run on the host:
+ *   gcc -o songc songc.c
+ *   ./songc [-b budget] song.mid songName > ../res/song.inc
+ *   ./songc [-b budget] -r song.mid > song.sng
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// must match kernel/defines.h
+#define SONG_EV_NOTE			0x00
+#define SONG_EV_VOLUME			0x10
+#define SONG_EV_EXPRESSION		0x20
+#define SONG_EV_TREMOLO_LEVEL	0x30
+#define SONG_EV_TREMOLO_RATE	0x40
+#define SONG_EV_PATCH			0x50
+#define SONG_EV_LOOP_START		0x60
+#define SONG_EV_LOOP_END		0x70
+#define SONG_EV_WAIT			0x80
+#define SONG_EV_END				0xf0
+#define SONG_EVENTS_PER_FRAME	8
+
+// must match kernel/uzeboxSoundEngine.c
+#define CONTROLER_VOL 7
+#define CONTROLER_EXPRESSION 11
+#define CONTROLER_TREMOLO 92
+#define CONTROLER_TREMOLO_RATE 100
+
+#define CHANNELS 5
+#define FRAME_RATE 60
+
+struct MidiEvent {
+	unsigned long tick;
+	int order; // file order, keeps simultaneous events stable
+	unsigned char status; // 0xff for meta events
+	unsigned char data1, data2;
+};
+
+struct SongEvent {
+	unsigned long frame;
+	unsigned char type, param1, param2;
+};
+
+static unsigned char* file;
+static long fileSize;
+
+static struct MidiEvent* midiEvents;
+static int midiCount, midiCapacity;
+
+static void fail(const char* msg) {
+	fprintf(stderr, "songc: %s\n", msg);
+	exit(1);
+}
+
+static unsigned long readBE(long pos, int bytes) {
+	unsigned long v = 0;
+	if(pos + bytes > fileSize)
+		fail("unexpected end of file");
+	while(bytes--)
+		v = (v << 8) | file[pos++];
+	return v;
+}
+
+static unsigned long readVarLen(long* pos, long end) {
+	unsigned long v = 0;
+	unsigned char c;
+	do {
+		if(*pos >= end)
+			fail("unexpected end of track");
+		c = file[(*pos)++];
+		v = (v << 7) | (c & 0x7f);
+	} while(c & 0x80);
+	return v;
+}
+
+static void addMidiEvent(unsigned long tick, unsigned char status, unsigned char data1, unsigned char data2) {
+	if(midiCount == midiCapacity) {
+		midiCapacity = midiCapacity ? midiCapacity * 2 : 256;
+		midiEvents = realloc(midiEvents, midiCapacity * sizeof(struct MidiEvent));
+		if(!midiEvents)
+			fail("out of memory");
+	}
+	midiEvents[midiCount].tick = tick;
+	midiEvents[midiCount].order = midiCount;
+	midiEvents[midiCount].status = status;
+	midiEvents[midiCount].data1 = data1;
+	midiEvents[midiCount].data2 = data2;
+	midiCount++;
+}
+
+// tempo map, sorted by tick once all the tracks are read
+static unsigned long tempoTicks[256], tempoValues[256];
+static int tempoCount;
+
+static void parseTrack(long pos, long end) {
+	unsigned long tick = 0, len;
+	unsigned char status = 0, c, type;
+
+	while(pos < end) {
+		tick += readVarLen(&pos, end);
+		c = file[pos++];
+
+		if(c == 0xff) {
+			type = file[pos++];
+			len = readVarLen(&pos, end);
+			if(type == 0x51 && len == 3) {
+				if(tempoCount == 256)
+					fail("too many tempo changes");
+				tempoTicks[tempoCount] = tick;
+				tempoValues[tempoCount++] = readBE(pos, 3);
+			}
+			else if(type == 0x06 && len == 1 && (file[pos] == 'S' || file[pos] == 'E')) {
+				addMidiEvent(tick, 0xff, file[pos], 0);
+			}
+			else if(type == 0x2f) {
+				addMidiEvent(tick, 0xff, 0x2f, 0);
+			}
+			pos += len;
+			continue;
+		}
+		if(c == 0xf0 || c == 0xf7) {
+			len = readVarLen(&pos, end);
+			pos += len;
+			continue;
+		}
+
+		if(c & 0x80) {
+			status = c;
+			c = file[pos++];
+		}
+		else if(!status) {
+			fail("running status without a status byte");
+		}
+
+		switch(status & 0xf0) {
+		case 0x80: case 0x90: case 0xa0: case 0xb0: case 0xe0:
+			addMidiEvent(tick, status, c, file[pos++]);
+			break;
+		case 0xc0: case 0xd0:
+			addMidiEvent(tick, status, c, 0);
+			break;
+		}
+	}
+}
+
+static int compareMidiEvents(const void* a, const void* b) {
+	const struct MidiEvent* ea = a;
+	const struct MidiEvent* eb = b;
+	if(ea->tick != eb->tick)
+		return ea->tick < eb->tick ? -1 : 1;
+	return ea->order - eb->order;
+}
+
+static int compareTempo(const void* a, const void* b) {
+	const unsigned long* ta = a;
+	const unsigned long* tb = b;
+	return *ta < *tb ? -1 : *ta > *tb;
+}
+
+// converts a tick to a frame using the tempo map
+static unsigned long tickToFrame(unsigned long tick, unsigned int division) {
+	double us = 0;
+	unsigned long lastTick = 0, tempo = 500000; // 120bpm until told otherwise
+	int i;
+
+	for(i = 0; i < tempoCount && tempoTicks[i] <= tick; i++) {
+		us += (double)(tempoTicks[i] - lastTick) * tempo / division;
+		lastTick = tempoTicks[i];
+		tempo = tempoValues[i];
+	}
+	us += (double)(tick - lastTick) * tempo / division;
+	return (unsigned long)(us * FRAME_RATE / 1000000.0 + 0.5);
+}
+
+static int toSongEvent(struct MidiEvent* m, unsigned int division, struct SongEvent* e) {
+	unsigned char channel = m->status & 0x0f;
+
+	e->frame = tickToFrame(m->tick, division);
+	e->param1 = m->data1;
+	e->param2 = 0;
+
+	if(m->status == 0xff) {
+		e->type = m->data1 == 'S' ? SONG_EV_LOOP_START : m->data1 == 'E' ? SONG_EV_LOOP_END : SONG_EV_END;
+		e->param1 = 0;
+		return 1;
+	}
+	if(channel >= CHANNELS)
+		return 0;
+
+	switch(m->status & 0xf0) {
+	case 0x80:
+		e->type = SONG_EV_NOTE | channel;
+		return 1;
+	case 0x90:
+		e->type = SONG_EV_NOTE | channel;
+		e->param2 = m->data2 << 1;
+		return 1;
+	case 0xb0:
+		e->param1 = m->data2 << 1;
+		switch(m->data1) {
+		case CONTROLER_VOL: e->type = SONG_EV_VOLUME | channel; return 1;
+		case CONTROLER_EXPRESSION: e->type = SONG_EV_EXPRESSION | channel; return 1;
+		case CONTROLER_TREMOLO: e->type = SONG_EV_TREMOLO_LEVEL | channel; return 1;
+		case CONTROLER_TREMOLO_RATE: e->type = SONG_EV_TREMOLO_RATE | channel; return 1;
+		}
+		return 0;
+	case 0xc0:
+		e->type = SONG_EV_PATCH | channel;
+		return 1;
+	}
+	return 0;
+}
+
+static int column, raw;
+
+static void emit(unsigned char b) {
+	if(raw) {
+		putchar(b);
+		return;
+	}
+	printf(column == 0 ? "\t0x%02x" : ", 0x%02x", b);
+	if(++column == 16) {
+		printf(",\n");
+		column = 0;
+	}
+}
+
+int main(int argc, char** argv) {
+	FILE* f;
+	long pos, len;
+	unsigned int tracks, division, budget = SONG_EVENTS_PER_FRAME;
+	unsigned long lastFrame = 0, endFrame = 0, delta, frameEvents = 0, worst = 0, over = 0, total = 0;
+	struct SongEvent e;
+	int argi = 1, i;
+
+	for(; argi < argc && argv[argi][0] == '-'; argi++) {
+		if(strcmp(argv[argi], "-b") == 0 && argi+1 < argc)
+			budget = atoi(argv[++argi]);
+		else if(strcmp(argv[argi], "-r") == 0)
+			raw = 1;
+		else
+			break;
+	}
+	if(argc - argi != (raw ? 1 : 2)) {
+		fprintf(stderr, "usage: songc [-b budget] song.mid songName\n");
+		fprintf(stderr, "       songc [-b budget] -r song.mid\n");
+		return 1;
+	}
+
+	f = fopen(argv[argi], "rb");
+	if(!f)
+		fail("can't open input file");
+	fseek(f, 0, SEEK_END);
+	fileSize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	file = malloc(fileSize);
+	if(!file || fread(file, 1, fileSize, f) != (size_t)fileSize)
+		fail("can't read input file");
+	fclose(f);
+
+	if(fileSize < 14 || memcmp(file, "MThd", 4) != 0)
+		fail("not a MIDI file");
+	tracks = readBE(10, 2);
+	division = readBE(12, 2);
+	if(division & 0x8000)
+		fail("SMPTE time division is not supported");
+
+	pos = 8 + readBE(4, 4);
+	for(i = 0; i < (int)tracks; i++) {
+		if(memcmp(file + pos, "MTrk", 4) != 0)
+			fail("bad track header");
+		len = readBE(pos + 4, 4);
+		parseTrack(pos + 8, pos + 8 + len);
+		pos += 8 + len;
+	}
+
+	qsort(midiEvents, midiCount, sizeof(struct MidiEvent), compareMidiEvents);
+	// tick and value are stored side by side, sort them by tick together
+	{
+		unsigned long pairs[256][2];
+		for(i = 0; i < tempoCount; i++) {
+			pairs[i][0] = tempoTicks[i];
+			pairs[i][1] = tempoValues[i];
+		}
+		qsort(pairs, tempoCount, sizeof(pairs[0]), compareTempo);
+		for(i = 0; i < tempoCount; i++) {
+			tempoTicks[i] = pairs[i][0];
+			tempoValues[i] = pairs[i][1];
+		}
+	}
+
+	if(!raw) {
+		printf("/*\n");
+		printf(" * Generated by tools/songc.c from %s, do not edit.\n", argv[argi]);
+		printf(" * Compiled song, play with SONG_COMPILED=1\n");
+		printf(" */\n");
+		printf("const char %s[] PROGMEM = {\n", argv[argi+1]);
+	}
+
+	for(i = 0; i <= midiCount; i++) {
+		if(i == midiCount) {
+			// the song ends with its longest track
+			e.frame = endFrame > lastFrame ? endFrame : lastFrame;
+			e.type = SONG_EV_END;
+			e.param1 = e.param2 = 0;
+		}
+		else if(!toSongEvent(&midiEvents[i], division, &e)) {
+			continue;
+		}
+		else if(e.type == SONG_EV_END) {
+			if(e.frame > endFrame)
+				endFrame = e.frame;
+			continue;
+		}
+
+		// the delta before this event, split with wait events if too long
+		delta = e.frame - lastFrame;
+		if(delta != 0 || total == 0)
+			frameEvents = 0;
+		while(delta > 255) {
+			emit(255);
+			emit(SONG_EV_WAIT); emit(0); emit(0);
+			delta -= 255;
+		}
+		emit(delta);
+		emit(e.type); emit(e.param1); emit(e.param2);
+		lastFrame = e.frame;
+		total++;
+
+		frameEvents++;
+		if(frameEvents > worst)
+			worst = frameEvents;
+		if(frameEvents == budget + 1) {
+			over++;
+			fprintf(stderr, "songc: %s: frame %lu goes over %u events\n", argv[argi], e.frame, budget);
+		}
+	}
+	emit(0); // delta after the end, keeps the stream a multiple of the event size
+	if(!raw)
+		printf(column ? "\n};\n" : "};\n");
+
+	fprintf(stderr, "songc: %s: %lu events, %lu frames, worst case %lu events per frame, %lu frames over budget\n",
+			argv[argi], total, lastFrame, worst, over);
+	return 0;
+}
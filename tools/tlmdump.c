@@ -0,0 +1,232 @@
+/*
+ * Telemetry decoder, reads the packets the game sends over the UART
+ * (TELEMETRY=1 in tacticsCore.c) and writes them out as CSV.
+ *
+ * Each packet is framed like UartSendPacket in the kernel: a sync byte,
+ * the payload length, the payload and its CRC-CCITT. The first payload
+ * byte is the record type, see the TLM_* defines of the game.
+ *
+ * Frames go to stdout, one line per frame. -e writes the game events
+ * (moves, attacks, turns, production and the end of the game) to a
+ * second CSV file, and -f writes the scanlines spent per control state
+ * in the folded format of flamegraph.pl. A summary is printed on stderr at the end of the input.
+ *
+ * Build and run on the host:
+ *   gcc -o tlmdump tlmdump.c
+ *   stty -F /dev/ttyUSB0 57600 raw
+ *   ./tlmdump [-e events.csv] [-f folded.txt] [/dev/ttyUSB0] > frames.csv
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// must match kernel/defines.h
+#define UART_PACKET_SYNC 0x7e
+#define UART_PACKET_OVERHEAD 4
+#define SYNC_HSYNC_PULSES 253
+
+// must match tacticsCore.c
+#define TLM_FRAME 0x01
+#define TLM_MOVE 0x02
+#define TLM_ATTACK 0x03
+#define TLM_TURN 0x04
+#define TLM_PRODUCE 0x05
+#define TLM_GAME_OVER 0x06
+#define TLM_OVERRUN 0xFF
+#define FRAME_SIZE 12
+#define EVENT_SIZE 7
+
+// controlState of the game, in enum order
+static const char* stateNames[] = {
+	"scrolling", "unit_menu", "unit_movement", "unit_moving", "unit_attack",
+	"end_turn", "pause", "menu", "production", "game_over"
+};
+#define STATES (int)(sizeof(stateNames) / sizeof(stateNames[0]))
+
+static FILE* eventsFile;
+static FILE* foldedFile;
+
+// totals for the summary and the folded output
+static unsigned long frames, lostFrames, overruns, badBytes, unknown;
+static unsigned long gameLines[STATES], taskLines[STATES], idleLines[STATES];
+static unsigned int worstLines = 0, worstRamTiles = 0, worstMusic = 0;
+static unsigned int lowestStack = 0xffff, txOverflows = 0;
+static int haveFrame;
+static unsigned int lastFrame;
+
+// same as _crc_ccitt_update of avr-libc
+static unsigned int crcUpdate(unsigned int crc, unsigned char data) {
+	data ^= crc & 0xff;
+	data ^= data << 4;
+	return ((((unsigned int)data << 8) | (crc >> 8)) ^ (unsigned char)(data >> 4) ^ ((unsigned int)data << 3)) & 0xffff;
+}
+
+static const char* stateName(unsigned char state) {
+	return state < STATES ? stateNames[state] : "unknown";
+}
+
+static void frameRecord(const unsigned char* p) {
+	unsigned int frame = p[1] | p[2] << 8;
+	unsigned char state = p[3] < STATES ? p[3] : 0;
+	unsigned int game = p[4], tasks = p[5];
+	unsigned int stack = p[7] | p[8] << 8;
+	unsigned int music = p[9] | p[10] << 8;
+	int overrun = game == TLM_OVERRUN;
+
+	if(haveFrame && frame != ((lastFrame + 1) & 0xffff))
+		lostFrames += (frame - lastFrame - 1) & 0xffff;
+	haveFrame = 1;
+	lastFrame = frame;
+	frames++;
+
+	printf("%u,%s,%u,%u,%d,%u,%u,%u,%u\n", frame, stateName(p[3]), overrun ? 0 : game, tasks,
+			overrun, p[6], stack, music, p[11]);
+
+	// a late frame used all of its lines
+	if(overrun) {
+		overruns++;
+		game = tasks < SYNC_HSYNC_PULSES ? SYNC_HSYNC_PULSES - tasks : 0;
+	}
+	gameLines[state] += game;
+	taskLines[state] += tasks;
+	if(game + tasks < SYNC_HSYNC_PULSES)
+		idleLines[state] += SYNC_HSYNC_PULSES - game - tasks;
+
+	if(game + tasks > worstLines)
+		worstLines = game + tasks;
+	if(p[6] > worstRamTiles)
+		worstRamTiles = p[6];
+	if(stack < lowestStack)
+		lowestStack = stack;
+	if(music > worstMusic)
+		worstMusic = music;
+	txOverflows = p[11];
+}
+
+static void eventRecord(const unsigned char* p) {
+	static const char* names[] = {"", "", "move", "attack", "turn", "produce", "game_over"};
+	if(!eventsFile)
+		return;
+	fprintf(eventsFile, "%u,%s,%u,%u,%u,%u\n", p[1] | p[2] << 8, names[p[0]], p[3], p[4], p[5], p[6]);
+}
+
+static void packet(const unsigned char* p, int len) {
+	if(p[0] == TLM_FRAME && len == FRAME_SIZE)
+		frameRecord(p);
+	else if(p[0] >= TLM_MOVE && p[0] <= TLM_GAME_OVER && len == EVENT_SIZE)
+		eventRecord(p);
+	else
+		unknown++;
+}
+
+static unsigned char buf[512];
+static int bufLen;
+
+static void drop(int count) {
+	bufLen -= count;
+	memmove(buf, buf + count, bufLen);
+}
+
+// decodes every complete packet in buf, resyncing like UartReadPacket
+static void parse(void) {
+	unsigned int crc;
+	int len, i;
+
+	while(bufLen > 0) {
+		if(buf[0] != UART_PACKET_SYNC) {
+			drop(1);
+			badBytes++;
+			continue;
+		}
+		if(bufLen < 2)
+			return;
+		len = buf[1];
+		if(len != 0) {
+			if(bufLen < len + UART_PACKET_OVERHEAD)
+				return;
+			crc = crcUpdate(0xffff, len);
+			for(i = 0; i < len; i++)
+				crc = crcUpdate(crc, buf[2 + i]);
+			if(buf[len + 2] == (crc & 0xff) && buf[len + 3] == crc >> 8) {
+				packet(buf + 2, len);
+				drop(len + UART_PACKET_OVERHEAD);
+				continue;
+			}
+		}
+		drop(1);
+		badBytes++;
+	}
+}
+
+static void writeFolded(void) {
+	int i;
+	for(i = 0; i < STATES; i++) {
+		if(gameLines[i])
+			fprintf(foldedFile, "frame;%s;game %lu\n", stateNames[i], gameLines[i]);
+		if(taskLines[i])
+			fprintf(foldedFile, "frame;%s;tasks %lu\n", stateNames[i], taskLines[i]);
+		if(idleLines[i])
+			fprintf(foldedFile, "frame;%s;idle %lu\n", stateNames[i], idleLines[i]);
+	}
+}
+
+static FILE* openOutput(const char* path) {
+	FILE* f = fopen(path, "w");
+	if(!f) {
+		fprintf(stderr, "tlmdump: can't create %s\n", path);
+		exit(1);
+	}
+	return f;
+}
+
+int main(int argc, char** argv) {
+	FILE* in = stdin;
+	int argi = 1, c;
+
+	for(; argi < argc && argv[argi][0] == '-'; argi++) {
+		if(strcmp(argv[argi], "-e") == 0 && argi+1 < argc)
+			eventsFile = openOutput(argv[++argi]);
+		else if(strcmp(argv[argi], "-f") == 0 && argi+1 < argc)
+			foldedFile = openOutput(argv[++argi]);
+		else
+			break;
+	}
+	if(argc - argi > 1 || (argi < argc && argv[argi][0] == '-')) {
+		fprintf(stderr, "usage: tlmdump [-e events.csv] [-f folded.txt] [input]\n");
+		return 1;
+	}
+	if(argi < argc) {
+		in = fopen(argv[argi], "rb");
+		if(!in) {
+			fprintf(stderr, "tlmdump: can't open %s\n", argv[argi]);
+			return 1;
+		}
+	}
+
+	// soak sessions are followed live, don't sit on whole lines
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	printf("frame,state,game_lines,task_lines,overrun,ram_tiles,stack_free,music_cycles,tx_overflows\n");
+	if(eventsFile) {
+		setvbuf(eventsFile, NULL, _IOLBF, 0);
+		fprintf(eventsFile, "frame,event,a,b,c,d\n");
+	}
+
+	while((c = getc(in)) != EOF) {
+		buf[bufLen++] = c;
+		parse();
+	}
+
+	if(foldedFile) {
+		writeFolded();
+		fclose(foldedFile);
+	}
+	if(eventsFile)
+		fclose(eventsFile);
+
+	fprintf(stderr, "tlmdump: %lu frames, %lu lost, %lu overruns, worst %u lines, %u ram tiles, %u music cycles\n",
+			frames, lostFrames, overruns, worstLines, worstRamTiles, worstMusic);
+	fprintf(stderr, "tlmdump: lowest free stack %u bytes, %u tx overflows, %lu bad bytes, %lu unknown packets\n",
+			lowestStack, txOverflows, badBytes, unknown);
+	return 0;
+}
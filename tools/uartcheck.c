@@ -0,0 +1,259 @@
+/*
+ * Check of the framed UART packets (UartSendPacket, UartReadPacket and
+ * GetUartStats in kernel/uzeboxCore.c), built from the kernel sources
+ * with both UART buffers, the TX buffer looped back to the RX one.
+ *
+ * Scanlines are run with the UART slot of the mixer (tools/host/core.c)
+ * and a model of the USART, at 57600 and 115200 bauds. A byte leaves when
+ * UDR0 is empty, every 2 or 3 lines at 57600 and every 1 or 2 lines at
+ * 115200, and arrives on the line after its last bit. Packets of random lengths are sent as long as they fit and read
+ * once per frame, or less often to overflow the RX buffer. On the line
+ * bytes can be flipped, lost or added, and some packets are longer than
+ * the reader takes.
+ *
+ * Every packet that got through whole must be read, in order, and no
+ * other. The RX overflow counter must match the bytes that did not fit,
+ * and bad packets must be counted. A packet that doesn't fit the TX
+ * buffer must be refused and counted without sending any of it.
+ *
+ * Build from default/ with make uartcheck, then:
+ *   ./uartcheck [-n packets]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uzebox.h"
+#include "core.h"
+
+#define LINES_PER_FRAME 262
+#define LINE_CYCLES 1820
+#define MAX_PAYLOAD 40 // what the reader takes, up to 8 more are sent
+#define MAX_PACKETS 100000
+#define WIRE_SIZE 4096
+
+struct Packet {
+	u8 len;
+	u8 data[MAX_PAYLOAD + 8];
+	char whole; // cleared when a byte is changed, lost or dropped
+};
+
+static struct Packet packets[MAX_PACKETS];
+static int sentCount, readCount;
+
+// bytes on the line, with the line they arrive on and their packet (-1 if added)
+static struct {
+	unsigned long line;
+	u8 value;
+	int packet;
+} wire[WIRE_SIZE];
+static int wireHead, wireCount;
+
+// the USART as the kernel sets it up (U2X0, 8N1): a byte takes 10 bits of
+// 8 * (UBRR0 + 1) cycles, UDR0 is empty again once the byte before starts
+// shifting out
+static unsigned long byteCycles, txDone;
+
+static unsigned long rngState = 3;
+
+static unsigned int rnd(unsigned int n) {
+	rngState = rngState * 6364136223846793005UL + 1442695040888963407UL;
+	return (rngState >> 33) % n;
+}
+
+static void toWire(unsigned long line, u8 value, int packet) {
+	int i = (wireHead + wireCount++) % WIRE_SIZE;
+	wire[i].line = line;
+	wire[i].value = value;
+	wire[i].packet = packet;
+}
+
+// the kernel counters are 8 bits, they are added up after each frame
+static unsigned long rxOverflows, badPackets;
+static struct UartStats last;
+
+static void addStats(void) {
+	struct UartStats stats;
+
+	GetUartStats(&stats);
+	rxOverflows += (u8)(stats.rxOverflows - last.rxOverflows);
+	badPackets += (u8)(stats.badPackets - last.badPackets);
+	last = stats;
+}
+
+static void reset(void) {
+	UartInitRxBuffer();
+	UartInitTxBuffer();
+	GetUartStats(&last);
+	rxOverflows = badPackets = 0;
+	sentCount = readCount = wireHead = wireCount = 0;
+}
+
+static int readAll(const char* name, unsigned long* skipped) {
+	u8 data[MAX_PAYLOAD];
+	u8 len;
+	int next;
+
+	// a damaged packet can still come out right, a byte lost at its end
+	// replaced by the same value from the start of the next one to arrive,
+	// which is then damaged too
+	while((len = UartReadPacket(data, MAX_PAYLOAD)) != 0) {
+		while(readCount < sentCount && !packets[readCount].whole &&
+				(len != packets[readCount].len || memcmp(data, packets[readCount].data, len) != 0)) {
+			readCount++;
+			(*skipped)++;
+		}
+		if(readCount == sentCount || len != packets[readCount].len || memcmp(data, packets[readCount].data, len) != 0) {
+			fprintf(stderr, "uartcheck: %s: read a packet that was not sent whole (%d bytes)\n", name, len);
+			return 1;
+		}
+		if(!packets[readCount].whole) {
+			for(next = readCount + 1; next < sentCount && !packets[next].whole; next++);
+			if(next < sentCount)
+				packets[next].whole = 0;
+		}
+		readCount++;
+	}
+	return 0;
+}
+
+static int run(const char* name, unsigned long bauds, int count, int corruptPerThousand, int readEvery) {
+	unsigned long line, now, arrival, skipped = 0, overflows = 0, txBytes = 0, packetEnd = 0;
+	int sent, i, txPacket = 0;
+
+	reset();
+	byteCycles = 10 * 8 * ((F_CPU + bauds * 4) / (bauds * 8));
+	txDone = 0;
+
+	// until all is sent and across, the last frame reads what's left
+	for(line = 0; sentCount < count || wireCount != 0 || UartTxFreeCount() != UART_TX_BUFFER_SIZE - 1; line++) {
+		if(line % LINES_PER_FRAME == 0) {
+			// the game sends what fits, then reads
+			while(sentCount < count) {
+				struct Packet* p = &packets[sentCount];
+				p->len = 1 + rnd(MAX_PAYLOAD + 8);
+				for(i = 0; i < p->len; i++)
+					p->data[i] = rnd(8) == 0 ? UART_PACKET_SYNC : rnd(256);
+				p->whole = p->len <= MAX_PAYLOAD;
+				if(!UartSendPacket(p->data, p->len))
+					break;
+				sentCount++;
+			}
+			if(line / LINES_PER_FRAME % readEvery == 0 && readAll(name, &skipped))
+				return 1;
+			addStats();
+		}
+
+		// the byte arriving now, then the byte leaving
+		if(wireCount != 0 && wire[wireHead].line <= line) {
+			if(UartUnreadCount() == UART_RX_BUFFER_SIZE - 1) {
+				overflows++;
+				if(wire[wireHead].packet >= 0)
+					packets[wire[wireHead].packet].whole = 0;
+			}
+			hostUartLine(wire[wireHead].value, 0);
+			wireHead = (wireHead + 1) % WIRE_SIZE;
+			wireCount--;
+		}
+		now = line * LINE_CYCLES;
+		sent = hostUartLine(-1, now + byteCycles >= txDone);
+		if(sent < 0)
+			continue;
+		txDone = (txDone > now ? txDone : now) + byteCycles;
+		arrival = (txDone + LINE_CYCLES - 1) / LINE_CYCLES;
+
+		// which packet the byte is from
+		if(txBytes == packetEnd)
+			packetEnd += packets[txPacket++].len + UART_PACKET_OVERHEAD;
+		txBytes++;
+
+		// flipped, lost, or followed by an added byte, which only damages
+		// the packet if it's not after its last byte
+		i = (int)rnd(1000) < corruptPerThousand ? rnd(3) : 3;
+		if(i < 2 || (i == 2 && txBytes != packetEnd))
+			packets[txPacket - 1].whole = 0;
+		if(i == 0)
+			toWire(arrival, sent ^ (1 << rnd(8)), txPacket - 1);
+		else if(i >= 2)
+			toWire(arrival, sent, txPacket - 1);
+		if(i == 2)
+			toWire(arrival, rnd(256), -1);
+	}
+	if(readAll(name, &skipped))
+		return 1;
+	addStats();
+	for(; readCount < sentCount; readCount++) {
+		if(packets[readCount].whole) {
+			fprintf(stderr, "uartcheck: %s: packet %d got through whole but was never read\n", name, readCount);
+			return 1;
+		}
+		skipped++;
+	}
+
+	printf("%-24s %6lu %7d %8lu %7lu %9lu %9lu\n", name, bauds, sentCount, sentCount - skipped, skipped, badPackets, overflows);
+	if(rxOverflows != overflows) {
+		fprintf(stderr, "uartcheck: %s: %lu bytes did not fit, %lu RX overflows counted\n", name, overflows, rxOverflows);
+		return 1;
+	}
+	if(skipped != 0 && badPackets == 0) {
+		fprintf(stderr, "uartcheck: %s: packets were dropped without counting bad bytes\n", name);
+		return 1;
+	}
+	return 0;
+}
+
+// packets that don't fit the TX buffer are refused whole
+static int txFull(void) {
+	struct UartStats before, after;
+	u8 data[UART_TX_BUFFER_SIZE];
+	u8 fits = UART_TX_BUFFER_SIZE - 1 - UART_PACKET_OVERHEAD;
+
+	reset();
+	memset(data, 0x55, sizeof(data));
+	GetUartStats(&before);
+	if(UartSendPacket(data, 0) || !UartSendPacket(data, fits) || UartTxFreeCount() != 0 ||
+			UartSendPacket(data, 1) || UartTxFreeCount() != 0) {
+		fprintf(stderr, "uartcheck: a packet of %d bytes must fill the TX buffer and no more may go in\n", fits);
+		return 1;
+	}
+	while(hostUartLine(-1, 1) >= 0);
+	if(UartSendPacket(data, fits + 1) || UartTxFreeCount() != UART_TX_BUFFER_SIZE - 1) {
+		fprintf(stderr, "uartcheck: a packet of %d bytes went partly into the TX buffer\n", fits + 1);
+		return 1;
+	}
+	GetUartStats(&after);
+	if((u8)(after.txOverflows - before.txOverflows) != 3) {
+		fprintf(stderr, "uartcheck: refused packets were not counted as TX overflows\n");
+		return 1;
+	}
+	printf("TX buffer: a %d byte packet fills it, empty and longer packets are refused and counted\n", fits);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	static const unsigned long bauds[] = {57600, 115200};
+	int count = 20000, argi = 1, i;
+
+	for(; argi < argc && argv[argi][0] == '-'; argi++) {
+		if(strcmp(argv[argi], "-n") == 0 && argi+1 < argc)
+			count = atoi(argv[++argi]);
+		else
+			break;
+	}
+	if(argi < argc || count < 1 || count > MAX_PACKETS) {
+		fprintf(stderr, "usage: uartcheck [-n packets, at most %d]\n", MAX_PACKETS);
+		return 1;
+	}
+
+	printf("line                      bauds packets     read skipped bad bytes overflows\n");
+	for(i = 0; i < 2; i++) {
+		if(run("clean", bauds[i], count, 0, 1) ||
+				run("1/1000 bytes damaged", bauds[i], count, 1, 1) ||
+				run("1/100 bytes damaged", bauds[i], count, 10, 1) ||
+				run("1/20 bytes damaged", bauds[i], count, 50, 1) ||
+				run("read every 4th frame", bauds[i], count, 0, 4) ||
+				run("both", bauds[i], count, 10, 4))
+			return 1;
+	}
+	return txFull();
+}